@@ -0,0 +1,309 @@
+#include "analysis_cache.h"
+#include "constants.h"
+#include "get_moves.h"
+#include "helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ANALYSIS CACHE
+// remembers the results of completed searches across runs: every search of at least CACHE_MIN_RECORD_DEPTH appends a record of its
+// best move, score, depth and principal variation to the file, which is mapped for reading. an index in memory maps zobrist hashes
+// to the deepest record of each position. before a search the position is looked up: a record as deep as the search wants is the
+// answer, a shallower one still seeds the transposition table with its principal variation. appends never rewrite the file, so
+// superseded records pile up until compact_analysis_cache drops them offline.
+// one cache is open per process, shared by its engines behind a lock (lookups are rare, one per search)
+
+#define CACHE_MAP_GROWTH (UINT64_C(64) << 20) // the mapping is extended in steps of this many bytes past the end of the file
+
+int AnalysisCacheDepth = CACHE_DEFAULT_DEPTH;
+
+typedef struct AnalysisCache {
+    int fd;
+    const uint8_t* map;
+    size_t map_size;
+    uint64_t count; // records in the file
+    uint32_t* index; // record number + 1 of the deepest record of each position, open addressing by key, 0 for empty
+    uint64_t index_mask;
+} AnalysisCache;
+
+static AnalysisCache cache = {-1, NULL, 0, 0, NULL, 0};
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t mix(uint64_t x){
+    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+}
+
+// hashes the same fields as get_hash with unrelated arithmetic, two positions that share a zobrist hash almost never share this too
+static uint64_t position_check(const uint64_t* board){
+    uint64_t check = 0;
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+        check = mix(check ^ board[pc] ^ (uint64_t)pc << 59);
+    }
+    uint64_t info_bits = WHITE_KINGSIDE_RIGHT | WHITE_QUEENSIDE_RIGHT | BLACK_KINGSIDE_RIGHT | BLACK_QUEENSIDE_RIGHT | TURN_BIT | (~RANK_1 & ~RANK_8);
+    return mix(check ^ (board[INFO] & info_bits));
+}
+
+static void fill_header(CacheHeader* header){
+    memset(header, 0, sizeof(CacheHeader));
+    header->magic = CACHE_MAGIC;
+    header->version = CACHE_VERSION;
+    header->zobrist_seed = PRIME;
+    header->zobrist_check = zobrist_signature();
+    header->record_size = sizeof(CacheRecord);
+}
+
+static inline const CacheRecord* cache_record(uint64_t number){
+    return (const CacheRecord*)(cache.map + sizeof(CacheHeader)) + number;
+}
+
+// makes record number the indexed one of its position unless a deeper record is indexed already
+static void index_record(uint64_t number){
+    const CacheRecord* record = cache_record(number);
+    uint64_t slot = record->key & cache.index_mask;
+    while (cache.index[slot] != 0){
+        const CacheRecord* indexed = cache_record(cache.index[slot] - 1);
+        if (indexed->key == record->key && indexed->check == record->check){
+            if (record->depth >= indexed->depth) cache.index[slot] = number + 1;
+            return;
+        }
+        slot = (slot + 1) & cache.index_mask;
+    }
+    cache.index[slot] = number + 1;
+}
+
+// keeps the index at most half full, false if out of memory
+static bool grow_index(uint64_t records){
+    if (records * 2 <= cache.index_mask + 1 && cache.index != NULL) return true;
+    uint64_t size = 1024;
+    while (size < records * 2) size *= 2;
+    uint32_t* index = calloc(size, sizeof(uint32_t));
+    if (index == NULL) return false;
+    free(cache.index);
+    cache.index = index;
+    cache.index_mask = size - 1;
+    for (uint64_t i = 0; i < cache.count; i++){
+        index_record(i);
+    }
+    return true;
+}
+
+// maps the file with room to append to, false if mapping fails
+static bool map_cache(size_t file_size){
+    size_t map_size = (file_size / CACHE_MAP_GROWTH + 1) * CACHE_MAP_GROWTH;
+    const uint8_t* map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, cache.fd, 0);
+    if (map == MAP_FAILED) return false;
+    if (cache.map != NULL) munmap((void*)cache.map, cache.map_size);
+    cache.map = map;
+    cache.map_size = map_size;
+    return true;
+}
+
+/**
+ * Opens the analysis cache of the process, creating the file if it does not exist. A record cut short by a crash is dropped.
+ * @param filename The cache file.
+ * @return false if the file cannot be opened or was written with other zobrist keys or another record format.
+ */
+bool open_analysis_cache(const char* filename){
+    close_analysis_cache();
+    pthread_mutex_lock(&cache_lock);
+    CacheHeader expected;
+    fill_header(&expected);
+    bool ok = false;
+    cache.fd = open(filename, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (cache.fd >= 0 && fstat(cache.fd, &st) == 0){
+        size_t size = st.st_size;
+        if (size == 0){
+            ok = write(cache.fd, &expected, sizeof(expected)) == sizeof(expected);
+            size = sizeof(expected);
+        } else {
+            CacheHeader header;
+            ok = pread(cache.fd, &header, sizeof(header), 0) == sizeof(header) && memcmp(&header, &expected, sizeof(header)) == 0;
+        }
+        if (ok){
+            cache.count = (size - sizeof(CacheHeader)) / sizeof(CacheRecord);
+            size = sizeof(CacheHeader) + cache.count * sizeof(CacheRecord);
+            ok = ftruncate(cache.fd, size) == 0 && lseek(cache.fd, size, SEEK_SET) >= 0 && map_cache(size) && grow_index(cache.count);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (!ok){
+        printf("Invalid analysis cache %s\n", filename);
+        close_analysis_cache();
+    }
+    return ok;
+}
+
+/**
+ * Closes the analysis cache, searches run without one afterwards.
+ */
+void close_analysis_cache(){
+    pthread_mutex_lock(&cache_lock);
+    if (cache.map != NULL) munmap((void*)cache.map, cache.map_size);
+    if (cache.fd >= 0) close(cache.fd);
+    free(cache.index);
+    cache = (AnalysisCache){-1, NULL, 0, 0, NULL, 0};
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// the deepest record of a position, copied to out. called with the cache lock held
+static bool find_record(const uint64_t* board, CacheRecord* out){
+    if (cache.index == NULL) return false;
+    uint64_t key = get_hash((uint64_t*)board);
+    uint64_t check = position_check(board);
+    for (uint64_t slot = key & cache.index_mask; cache.index[slot] != 0; slot = (slot + 1) & cache.index_mask){
+        const CacheRecord* record = cache_record(cache.index[slot] - 1);
+        if (record->key == key && record->check == check){
+            *out = *record;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the legal move of the position with the record's code, false if there is none (a record of another engine version)
+static bool legal_pv_move(uint64_t code, uint64_t* board, Move* out){
+    Move stored = decrypt_move(code);
+    Move movs[MOVES_ARRAY_LENGTH];
+    get_legal_moves(movs, board);
+    for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+        if (same_move(movptr, &stored)){
+            *out = *movptr;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Looks a position up before searching it. A record at least depth_wanted deep is returned as the search result, a shallower one
+ * has its principal variation added to the transposition table to guide the search.
+ * @param board The root position, left unchanged.
+ * @param depth_wanted The depth the search would go to.
+ * @param tt The table of the engine that is about to search, may be NULL.
+ * @param depth Set to the depth of a returned record.
+ * @return The result chain of the record, to be freed with free_search_result, or NULL to search.
+ */
+searchResult* consult_analysis_cache(uint64_t* board, int depth_wanted, TransTable* tt, int* depth){
+    CacheRecord record;
+    pthread_mutex_lock(&cache_lock);
+    bool found = find_record(board, &record);
+    pthread_mutex_unlock(&cache_lock);
+    if (!found || record.pv_length == 0) return NULL;
+
+    // replay the principal variation, every move has to be legal
+    Move line[CACHE_MAX_PV];
+    int length = 0;
+    while (length < record.pv_length && legal_pv_move(record.pv[length], board, &line[length])){
+        if (tt != NULL && record.depth - length > 0){
+            add_item(tt, &line[length], EXACT, record.depth - length, get_hash(board));
+        }
+        apply_move(&line[length], board);
+        length++;
+    }
+    for (int i = length - 1; i >= 0; i--){
+        apply_move(&line[i], board);
+    }
+    if (length == 0 || record.depth < depth_wanted) return NULL;
+
+    searchResult* result = malloc(sizeof(searchResult)); // the end of the line
+    result->best_result = NULL;
+    result->best_move.type = BOOK_END;
+    result->best_eval = record.score;
+    for (int i = length - 1; i >= 0; i--){
+        searchResult* r = malloc(sizeof(searchResult));
+        r->best_move = copy_move(&line[i]);
+        r->best_eval = record.score;
+        r->best_result = result;
+        result = r;
+    }
+    *depth = record.depth;
+    return result;
+}
+
+/**
+ * Appends the result of a completed search to the analysis cache, if one is open and the search was deep enough to be worth it.
+ * @param board The root position.
+ * @param best The result of the last completed iteration.
+ * @param depth The depth of that iteration.
+ */
+void record_analysis(uint64_t* board, const searchResult* best, int depth){
+    if (depth < CACHE_MIN_RECORD_DEPTH || best == NULL || best->best_move.type == BOOK_END) return;
+    CacheRecord record;
+    memset(&record, 0, sizeof(record));
+    record.key = get_hash(board);
+    record.check = position_check(board);
+    record.score = best->best_eval;
+    record.depth = depth;
+    for (const searchResult* r = best; r != NULL && r->best_move.type != BOOK_END && record.pv_length < CACHE_MAX_PV; r = r->best_result){
+        Move m = r->best_move;
+        record.pv[record.pv_length++] = encrypt_move(&m);
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    CacheRecord indexed;
+    bool known = find_record(board, &indexed) && indexed.depth >= depth;
+    if (cache.fd >= 0 && !known && grow_index(cache.count + 1)){
+        size_t end = sizeof(CacheHeader) + cache.count * sizeof(CacheRecord);
+        bool ok = pwrite(cache.fd, &record, sizeof(record), end) == sizeof(record);
+        if (ok && end + sizeof(record) > cache.map_size){
+            ok = map_cache(end + sizeof(record));
+        }
+        if (ok){
+            index_record(cache.count++);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Rewrites an analysis cache with only the deepest record of each position. Run it offline, records appended meanwhile are lost.
+ * @param filename The cache to compact.
+ * @param out_filename The compacted cache, replaced if it exists.
+ * @return The number of records kept, -1 on error.
+ */
+int compact_analysis_cache(const char* filename, const char* out_filename){
+    if (!open_analysis_cache(filename)) return -1;
+    FILE* file = fopen(out_filename, "wb");
+    if (file == NULL){
+        printf("Error opening file\n");
+        close_analysis_cache();
+        return -1;
+    }
+    CacheHeader header;
+    fill_header(&header);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    int kept = 0;
+    // records are written in file order, so a compacted cache keeps the order the searches completed in
+    pthread_mutex_lock(&cache_lock);
+    bool* keep = calloc(cache.count + 1, sizeof(bool));
+    for (uint64_t slot = 0; keep != NULL && slot <= cache.index_mask; slot++){
+        if (cache.index[slot] != 0) keep[cache.index[slot] - 1] = true;
+    }
+    for (uint64_t i = 0; ok && keep != NULL && i < cache.count; i++){
+        if (keep[i]){
+            ok = fwrite(cache_record(i), sizeof(CacheRecord), 1, file) == 1;
+            kept++;
+        }
+    }
+    ok = ok && keep != NULL;
+    uint64_t total = cache.count;
+    free(keep);
+    pthread_mutex_unlock(&cache_lock);
+    ok = fclose(file) == 0 && ok;
+    close_analysis_cache();
+    if (!ok){
+        printf("Error writing file %s\n", out_filename);
+        return -1;
+    }
+    printf("Kept %d of %llu records\n", kept, (unsigned long long)total);
+    return kept;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "search.h"
+#include "hash_table.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CACHE_MAGIC 0x43414243 // "CBAC"
+#define CACHE_VERSION 1
+#define CACHE_MAX_PV 16
+#define CACHE_MIN_RECORD_DEPTH 4 // shallower searches are cheaper to repeat than to store
+#define CACHE_DEFAULT_DEPTH 10 // a search without a depth limit is answered by a record at least this deep
+
+// file layout: the header, then records appended in the order the searches completed
+typedef struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t zobrist_seed;
+    uint64_t zobrist_check; // see zobrist_signature
+    uint32_t record_size;
+    uint32_t reserved;
+} CacheHeader;
+
+typedef struct CacheRecord {
+    uint64_t key; // zobrist hash
+    uint64_t check; // a second, independent hash of the position, a record is only used when both match
+    int16_t score; // white's point of view
+    uint8_t depth;
+    uint8_t pv_length;
+    uint32_t reserved;
+    uint64_t pv[CACHE_MAX_PV]; // encrypt_move codes, pv[0] is the best move
+} CacheRecord;
+
+extern int AnalysisCacheDepth;
+
+bool open_analysis_cache(const char* filename);
+void close_analysis_cache();
+searchResult* consult_analysis_cache(uint64_t* board, int depth_wanted, TransTable* tt, int* depth);
+void record_analysis(uint64_t* board, const searchResult* best, int depth);
+int compact_analysis_cache(const char* filename, const char* out_filename);
@@ -0,0 +1,402 @@
+#include "bitbase.h"
+#include "constants.h"
+#include "helpers.h"
+#include "get_moves.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// BITBASES
+// win/draw/loss of every position of small endgames such as KPK, KRK and KQK, generated by retrograde analysis with the engine's
+// own move generator: mates and stalemates are resolved first, then every pass resolves the positions with a move into a lost
+// position (won) or with only moves into won positions (lost), until nothing changes and the rest is drawn. captures and promotions
+// leave the endgame, they are looked up in bitbases generated earlier, so KQK and KRK have to be generated before KPK.
+//
+// a position's index is the side to move (0 white) followed by 6 bits per piece square, in the order of the table's pieces.
+// tables are stored with the stronger side white, positions with black stronger are probed with colours swapped and ranks flipped
+
+#define BB_UNKNOWN 3  // not resolved yet, only during generation
+#define BB_MISSING -2 // a capture or promotion leads to an endgame with no bitbase
+
+typedef struct Bitbase {
+    uint64_t key;
+    uint64_t mirror_key; // key with the colours swapped
+    int num_pieces;
+    int pieces[BITBASE_MAX_PIECES];
+    const uint8_t* data;
+    uint8_t* owned;      // data generated by this process, NULL if it is in the mapped file
+} Bitbase;
+
+typedef struct BitbaseWorker {
+    pthread_t thread;
+    const Bitbase* table;
+    uint8_t* values;     // one byte per position while generating
+    uint64_t start;
+    uint64_t end;
+    bool first_pass;
+    uint64_t changed;
+    bool missing;
+} BitbaseWorker;
+
+static Bitbase bitbases[BITBASE_MAX_TABLES];
+static int num_bitbases = 0;
+static int max_pieces = 0;
+static uint8_t* mapped_file = NULL;
+static size_t mapped_size = 0;
+
+static uint64_t mirror_material(uint64_t key){
+    return ((key & 0xFFFFFF) << 24) | ((key >> 24) & 0xFFFFFF); // white's 6 nibbles and black's 6 nibbles swap places
+}
+
+static inline uint64_t table_size(int num_pieces){
+    return UINT64_C(2) << (6 * num_pieces);
+}
+
+static inline int read_value(const uint8_t* data, uint64_t idx){
+    return (data[idx >> 2] >> ((idx & 3) << 1)) & 3;
+}
+
+static inline bool side_to_move_in_check(const uint64_t* board){
+    return (board[INFO] & TURN_BIT) ? (board[WHITE_KING] & get_black_attackers(board)) != 0 : (board[BLACK_KING] & get_white_attackers(board)) != 0;
+}
+
+// index of a position in a table, flip when black is the stronger side
+static uint64_t encode(const Bitbase* table, const uint64_t* board, bool flip){
+    uint64_t idx = ((board[INFO] & TURN_BIT) == 0) ^ flip;
+    int colour_swap = flip ? BLACK_PAWN : 0;
+    int square_flip = flip ? 56 : 0;
+    uint64_t used = 0;
+    for (int i = 0; i < table->num_pieces; i++){
+        int pc = (table->pieces[i] + colour_swap) % 12;
+        uint64_t remaining = board[pc] & ~used; // several pieces of a kind take their squares in order
+        uint64_t bit = remaining & -remaining;
+        used |= bit;
+        idx = (idx << 6) | (__builtin_ctzll(bit) ^ square_flip);
+    }
+    return idx;
+}
+
+// position of an index, false if pieces overlap or a pawn is on the first or last rank
+static bool decode(const Bitbase* table, uint64_t idx, uint64_t* board){
+    memset(board, 0, BOARD_ARRAY_SIZE * sizeof(uint64_t));
+    uint64_t occupied = 0;
+    for (int i = table->num_pieces - 1; i >= 0; i--){
+        uint64_t bit = UINT64_C(1) << (idx & 63);
+        idx >>= 6;
+        if (occupied & bit) return false;
+        occupied |= bit;
+        board[table->pieces[i]] |= bit;
+    }
+    board[INFO] = idx ? 0 : TURN_BIT;
+    prep_board(board);
+    return !((board[WHITE_PAWN] | board[BLACK_PAWN]) & (RANK_1 | RANK_8));
+}
+
+// parses a signature such as "KPK", the pieces up to the second K belong to the stronger side
+static bool parse_signature(const char* signature, Bitbase* table){
+    static const char LETTERS[] = "PNBRQK";
+    int side = WHITE_PAWN;
+    int kings = 0;
+    table->num_pieces = 0;
+    table->key = 0;
+    for (const char* p = signature; *p; p++){
+        const char* letter = strchr(LETTERS, *p);
+        if (letter == NULL || table->num_pieces == BITBASE_MAX_PIECES) return false;
+        if (*p == 'K' && kings++){
+            side = BLACK_PAWN;
+        }
+        int pc = side + (int)(letter - LETTERS);
+        table->pieces[table->num_pieces++] = pc;
+        table->key += UINT64_C(1) << (pc << 2);
+    }
+    table->mirror_key = mirror_material(table->key);
+    return kings == 2 && signature[0] == 'K';
+}
+
+static void register_bitbase(const Bitbase* table){
+    bitbases[num_bitbases++] = *table;
+    max_pieces = max(max_pieces, table->num_pieces);
+}
+
+static const Bitbase* find_bitbase(uint64_t key){
+    for (int i = 0; i < num_bitbases; i++){
+        if (bitbases[i].key == key || bitbases[i].mirror_key == key) return &bitbases[i];
+    }
+    return NULL;
+}
+
+// GENERATION
+
+// value of a position outside the endgame being generated
+static int child_value(const uint64_t* board){
+    int value = probe_bitbase(board);
+    if (value != BB_NONE) return value;
+
+    // bare kings or a single minor piece cannot mate
+    uint64_t minors = board[WHITE_KNIGHT] | board[WHITE_BISHOP] | board[BLACK_KNIGHT] | board[BLACK_BISHOP];
+    uint64_t majors = board[WHITE_PAWN] | board[WHITE_ROOK] | board[WHITE_QUEEN] | board[BLACK_PAWN] | board[BLACK_ROOK] | board[BLACK_QUEEN];
+    return !majors && __builtin_popcountll(minors) <= 1 ? BB_DRAW : BB_MISSING;
+}
+
+static void* bitbase_worker(void* arg){
+    BitbaseWorker* worker = (BitbaseWorker*)arg;
+    const Bitbase* table = worker->table;
+    uint64_t board[BOARD_ARRAY_SIZE];
+    Move movs[MOVES_ARRAY_LENGTH];
+    worker->changed = 0;
+
+    for (uint64_t idx = worker->start; idx < worker->end; idx++){
+        if (__atomic_load_n(&worker->values[idx], __ATOMIC_RELAXED) != BB_UNKNOWN) continue;
+
+        if (!decode(table, idx, board)){
+            worker->values[idx] = BB_DRAW; // only reached in the first pass, never probed
+            continue;
+        }
+        if (worker->first_pass){
+            // the side that just moved cannot be in check
+            bool white = board[INFO] & TURN_BIT;
+            if (white ? (board[BLACK_KING] & get_white_attackers(board)) : (board[WHITE_KING] & get_black_attackers(board))){
+                worker->values[idx] = BB_DRAW;
+                continue;
+            }
+        }
+
+        int count = get_legal_moves(movs, board);
+        int value = BB_UNKNOWN;
+        if (count == 0){
+            value = side_to_move_in_check(board) ? BB_LOSS : BB_DRAW;
+        } else {
+            int wins = 0;
+            for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+                apply_move(movptr, board);
+                int child = board[MATERIAL] == table->key ? __atomic_load_n(&worker->values[encode(table, board, false)], __ATOMIC_RELAXED) : child_value(board);
+                apply_move(movptr, board);
+                if (child == BB_MISSING){
+                    worker->missing = true;
+                } else if (child == BB_LOSS){
+                    value = BB_WIN;
+                    break;
+                } else if (child == BB_WIN){
+                    wins++;
+                }
+            }
+            if (value == BB_UNKNOWN && wins == count){
+                value = BB_LOSS;
+            }
+        }
+        if (value != BB_UNKNOWN){
+            __atomic_store_n(&worker->values[idx], (uint8_t)value, __ATOMIC_RELAXED);
+            worker->changed++;
+        }
+    }
+    return NULL;
+}
+
+// fills table->owned, false if the endgame depends on one that has not been generated
+static bool generate_table(Bitbase* table, const char* signature, int num_threads){
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t size = table_size(table->num_pieces);
+    uint8_t* values = malloc(size);
+    memset(values, BB_UNKNOWN, size);
+
+    BitbaseWorker* workers = malloc(num_threads * sizeof(BitbaseWorker));
+    for (int t = 0; t < num_threads; t++){
+        workers[t].table = table;
+        workers[t].values = values;
+        workers[t].start = size * t / num_threads;
+        workers[t].end = size * (t + 1) / num_threads;
+        workers[t].missing = false;
+    }
+
+    int passes = 0;
+    uint64_t changed;
+    do {
+        for (int t = 0; t < num_threads; t++){
+            workers[t].first_pass = passes == 0;
+            pthread_create(&workers[t].thread, NULL, bitbase_worker, &workers[t]);
+        }
+        changed = 0;
+        bool missing = false;
+        for (int t = 0; t < num_threads; t++){
+            pthread_join(workers[t].thread, NULL);
+            changed += workers[t].changed;
+            missing |= workers[t].missing;
+        }
+        if (missing){
+            printf("%s leads to an endgame without a bitbase, generate its captures and promotions first\n", signature);
+            free(workers);
+            free(values);
+            return false;
+        }
+        passes++;
+    } while (changed);
+
+    // unresolved positions are draws, pack 4 positions per byte
+    uint64_t counts[3] = {0, 0, 0};
+    table->owned = calloc(size / 4, 1);
+    for (uint64_t idx = 0; idx < size; idx++){
+        int value = values[idx] == BB_UNKNOWN ? BB_DRAW : values[idx];
+        counts[value]++;
+        table->owned[idx >> 2] |= value << ((idx & 3) << 1);
+    }
+    table->data = table->owned;
+    free(workers);
+    free(values);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%s: %d passes, %llu won %llu lost %llu drawn or invalid, %.2f s\n", signature, passes, (unsigned long long)counts[BB_WIN],
+           (unsigned long long)counts[BB_LOSS], (unsigned long long)counts[BB_DRAW], (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    return true;
+}
+
+static bool write_bitbases(const char* filename){
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL){
+        printf("Error opening file\n");
+        return false;
+    }
+    BitbaseHeader header = {BITBASE_MAGIC, BITBASE_VERSION, (uint32_t)num_bitbases, 0};
+    fwrite(&header, sizeof(header), 1, file);
+
+    // tables start 64 byte aligned after the directory
+    uint64_t offset = (sizeof(BitbaseHeader) + num_bitbases * sizeof(BitbaseEntry) + 63) & ~UINT64_C(63);
+    for (int i = 0; i < num_bitbases; i++){
+        BitbaseEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.key = bitbases[i].key;
+        entry.offset = offset;
+        entry.num_pieces = (uint8_t)bitbases[i].num_pieces;
+        for (int p = 0; p < bitbases[i].num_pieces; p++){
+            entry.pieces[p] = (uint8_t)bitbases[i].pieces[p];
+        }
+        fwrite(&entry, sizeof(entry), 1, file);
+        offset += (table_size(bitbases[i].num_pieces) / 4 + 63) & ~UINT64_C(63);
+    }
+    for (int i = 0; i < num_bitbases; i++){
+        fseek(file, (long)((ftell(file) + 63) & ~63L), SEEK_SET);
+        fwrite(bitbases[i].data, 1, table_size(bitbases[i].num_pieces) / 4, file);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+/**
+ * Generates bitbases by retrograde analysis and writes them, with any already loaded, to a file.
+ * @param filename The bitbase file to write.
+ * @param signatures Endgames such as "KRK", stronger side first, each after the endgames its captures and promotions lead to.
+ * @param num_signatures The number of signatures.
+ * @param num_threads The number of worker threads, 0 for one per core.
+ * @return 1 if every bitbase was generated and written, 0 otherwise.
+ */
+int generate_bitbases(const char* filename, const char** signatures, int num_signatures, int num_threads){
+    if (num_threads <= 0){
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads < 1) num_threads = 1;
+
+    for (int i = 0; i < num_signatures; i++){
+        Bitbase table;
+        memset(&table, 0, sizeof(table));
+        if (!parse_signature(signatures[i], &table) || table.num_pieces < 3){
+            printf("Invalid bitbase signature %s\n", signatures[i]);
+            return 0;
+        }
+        if (find_bitbase(table.key) != NULL) continue;
+        if (num_bitbases == BITBASE_MAX_TABLES || !generate_table(&table, signatures[i], num_threads)){
+            return 0;
+        }
+        register_bitbase(&table);
+    }
+    return write_bitbases(filename);
+}
+
+/**
+ * Memory maps a bitbase file, its tables are probed by evaluate from then on.
+ * @param filename The file written by generate_bitbases.
+ * @return The number of tables loaded, 0 if the file does not exist, -1 if it is not a valid bitbase file.
+ */
+int load_bitbases(const char* filename){
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BitbaseHeader)){
+        close(fd);
+        printf("Invalid bitbase file %s\n", filename);
+        return -1;
+    }
+    uint8_t* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED){
+        printf("Error mapping file %s\n", filename);
+        return -1;
+    }
+
+    const BitbaseHeader* header = (const BitbaseHeader*)data;
+    bool valid = header->magic == BITBASE_MAGIC && header->version == BITBASE_VERSION && header->count <= BITBASE_MAX_TABLES
+              && sizeof(BitbaseHeader) + header->count * sizeof(BitbaseEntry) <= (size_t)st.st_size;
+    const BitbaseEntry* entries = (const BitbaseEntry*)(data + sizeof(BitbaseHeader));
+    for (uint32_t i = 0; valid && i < header->count; i++){
+        valid = entries[i].num_pieces >= 3 && entries[i].num_pieces <= BITBASE_MAX_PIECES
+             && entries[i].offset + table_size(entries[i].num_pieces) / 4 <= (uint64_t)st.st_size;
+    }
+    if (!valid){
+        printf("Invalid bitbase file %s\n", filename);
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    free_bitbases();
+    mapped_file = data;
+    mapped_size = st.st_size;
+    for (uint32_t i = 0; i < header->count; i++){
+        Bitbase table;
+        memset(&table, 0, sizeof(table));
+        table.key = entries[i].key;
+        table.mirror_key = mirror_material(entries[i].key);
+        table.num_pieces = entries[i].num_pieces;
+        for (int p = 0; p < table.num_pieces; p++){
+            table.pieces[p] = entries[i].pieces[p];
+        }
+        table.data = data + entries[i].offset;
+        register_bitbase(&table);
+    }
+    return num_bitbases;
+}
+
+/**
+ * Unmaps the bitbase file and frees generated bitbases.
+ */
+void free_bitbases(){
+    for (int i = 0; i < num_bitbases; i++){
+        free(bitbases[i].owned);
+    }
+    if (mapped_file != NULL){
+        munmap(mapped_file, mapped_size);
+        mapped_file = NULL;
+    }
+    num_bitbases = 0;
+    max_pieces = 0;
+}
+
+/**
+ * Looks up a position in the bitbases.
+ * @param board The position.
+ * @return BB_WIN, BB_DRAW or BB_LOSS for the side to move, or BB_NONE if no bitbase covers the material.
+ */
+int probe_bitbase(const uint64_t* board){
+    if (__builtin_popcountll(board[WHITE_PCS] | board[BLACK_PCS]) > max_pieces) return BB_NONE;
+    const Bitbase* table = find_bitbase(board[MATERIAL]);
+    if (table == NULL) return BB_NONE;
+    return read_value(table->data, encode(table, board, board[MATERIAL] != table->key));
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+
+#define BITBASE_MAGIC 0x42424243 // "CBBB"
+#define BITBASE_VERSION 1
+#define BITBASE_MAX_PIECES 4
+#define BITBASE_MAX_TABLES 32
+#define BITBASE_DEFAULT_FILE "bitbases.bin"
+
+// values stored per position, from the side to move's point of view
+enum BITBASE_VALUE {
+    BB_DRAW,
+    BB_WIN,
+    BB_LOSS,
+    BB_NONE = -1 // position not covered by any bitbase
+};
+
+// file layout: header, one entry per table, then the tables at their offsets, 2 bits per position
+typedef struct BitbaseHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+} BitbaseHeader;
+
+typedef struct BitbaseEntry {
+    uint64_t key;       // material key with the stronger side white
+    uint64_t offset;    // of the table from the start of the file
+    uint8_t num_pieces;
+    uint8_t pieces[BITBASE_MAX_PIECES]; // piece indices, the order of the squares in a position's index
+    uint8_t padding[3];
+} BitbaseEntry;
+
+int generate_bitbases(const char* filename, const char** signatures, int num_signatures, int num_threads);
+int load_bitbases(const char* filename);
+void free_bitbases();
+int probe_bitbase(const uint64_t* board);
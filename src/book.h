@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "get_moves.h"
+
+#define BOOK_ENTRY_SIZE 16 // key, move, weight, learn, big endian
+#define BOOK_MAX_MOVES 64 // book moves considered in one position
+#define BOOK_DEFAULT_MAX_PLY 24 // plies into the game the book is probed for
+
+// how a move is picked among the book moves of a position
+enum BOOK_SELECTION {
+    BOOK_BEST,      // the highest weight
+    BOOK_WEIGHTED   // at random, in proportion to the weights
+};
+
+extern int BookMaxPly;
+extern int BookSelection;
+
+bool open_book(const char* filename);
+void close_book();
+bool book_loaded();
+uint64_t polyglot_key(const uint64_t* board);
+uint16_t polyglot_move(const Move* move, const uint64_t* board);
+bool probe_book(uint64_t* board, int ply, Move* out);
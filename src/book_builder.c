@@ -0,0 +1,301 @@
+#include "book_builder.h"
+#include "book.h"
+#include "pgn.h"
+#include "constants.h"
+#include "helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// OPENING BOOK BUILDER
+// makes a polyglot book (see book.c) from PGN game collections. each file is split by byte range across a pool of worker threads that
+// replay the games with the move generator (see pgn.c) and count, for every position and move of the opening, the games it was played
+// in and how they ended for the side that played it. the counts live in a hash map sharded by position key, each shard behind its own
+// lock, and a worker gathers its updates per shard so a lock is taken once per batch rather than once per move.
+//
+// memory is bounded: every shard has a fixed number of slots and when one fills up, the moves seen the fewest times are dropped from it
+// behind a floor that only rises, so a huge collection keeps its common lines and loses only its rarest ones. a move's weight in the
+// book is 2 * wins + draws, the number of games it was played in times twice its score, which favours moves that are both popular and
+// successful. all weights are scaled down together when the largest would not fit in 16 bits
+
+#define SHARD_SHIFT (64 - __builtin_ctz(BUILDER_SHARDS))
+
+typedef struct MoveStat {
+    uint64_t key;
+    uint16_t move;
+    uint16_t reserved;
+    uint32_t games; // 0 for an empty slot
+    uint32_t wins; // for the side that played the move
+    uint32_t draws;
+} MoveStat;
+
+typedef struct Shard {
+    pthread_mutex_t lock;
+    MoveStat* slots;
+    size_t mask;
+    size_t used;
+    uint32_t floor; // moves seen this many times or fewer have been dropped
+} Shard;
+
+typedef struct MoveUpdate {
+    uint64_t key;
+    uint16_t move;
+    uint8_t score; // 0 loss, 1 draw, 2 win, for the side that played the move
+} MoveUpdate;
+
+typedef struct BuildWorker {
+    pthread_t thread;
+    PgnCursor cursor;
+    int max_ply;
+    long games;
+    long moves;
+    long unreadable; // games with a move that is not legal or cannot be parsed, counted up to that move
+    int num_pending[BUILDER_SHARDS];
+    MoveUpdate pending[BUILDER_SHARDS][BUILDER_BATCH];
+} BuildWorker;
+
+// book entry before it is written big endian
+typedef struct BookWeight {
+    uint64_t key;
+    uint16_t move;
+    uint16_t weight;
+} BookWeight;
+
+static Shard shards[BUILDER_SHARDS];
+
+// MOVE STATISTICS
+
+// the slot of the move, or the empty slot where it goes. called with the shard lock held
+static MoveStat* find_slot(Shard* shard, uint64_t key, uint16_t move){
+    size_t slot = (key ^ move * UINT64_C(0x9E3779B97F4A7C15)) & shard->mask;
+    while (shard->slots[slot].games != 0 && (shard->slots[slot].key != key || shard->slots[slot].move != move)){
+        slot = (slot + 1) & shard->mask;
+    }
+    return &shard->slots[slot];
+}
+
+// raises the floor until at most half of the slots are used, then rebuilds the shard from the moves above it
+static void prune_shard(Shard* shard){
+    size_t capacity = shard->mask + 1;
+    size_t kept;
+    do {
+        shard->floor++;
+        kept = 0;
+        for (size_t i = 0; i < capacity; i++) kept += shard->slots[i].games > shard->floor;
+    } while (kept > capacity / 2);
+
+    MoveStat* survivors = malloc(max(kept, 1) * sizeof(MoveStat));
+    if (survivors == NULL) kept = 0;
+    for (size_t i = 0, n = 0; i < capacity && n < kept; i++){
+        if (shard->slots[i].games > shard->floor) survivors[n++] = shard->slots[i];
+    }
+    memset(shard->slots, 0, capacity * sizeof(MoveStat));
+    for (size_t i = 0; i < kept; i++){
+        *find_slot(shard, survivors[i].key, survivors[i].move) = survivors[i];
+    }
+    shard->used = kept;
+    free(survivors);
+}
+
+// called with the shard lock held
+static void add_to_shard(Shard* shard, const MoveUpdate* update){
+    MoveStat* stat = find_slot(shard, update->key, update->move);
+    if (stat->games == 0){
+        if (shard->used >= (shard->mask + 1) / 4 * 3){
+            prune_shard(shard);
+            stat = find_slot(shard, update->key, update->move);
+        }
+        *stat = (MoveStat){update->key, update->move, 0, 0, 0, 0};
+        shard->used++;
+    }
+    stat->games++;
+    stat->wins += update->score == 2;
+    stat->draws += update->score == 1;
+}
+
+static void flush_shard(BuildWorker* worker, int s){
+    pthread_mutex_lock(&shards[s].lock);
+    for (int i = 0; i < worker->num_pending[s]; i++){
+        add_to_shard(&shards[s], &worker->pending[s][i]);
+    }
+    pthread_mutex_unlock(&shards[s].lock);
+    worker->num_pending[s] = 0;
+}
+
+// WORKERS
+
+static bool count_move(const uint64_t* board, const Move* move, int ply, const PgnGame* game, void* data){
+    (void)ply; // max_ply is applied by replay_pgn_game
+    BuildWorker* worker = data;
+    bool white = board[INFO] & TURN_BIT;
+    uint64_t key = polyglot_key(board);
+    int s = key >> SHARD_SHIFT;
+    worker->pending[s][worker->num_pending[s]++] = (MoveUpdate){key, polyglot_move(move, board), white ? game->result : 2 - game->result};
+    if (worker->num_pending[s] == BUILDER_BATCH) flush_shard(worker, s);
+    return true;
+}
+
+static void* build_worker(void* arg){
+    BuildWorker* worker = arg;
+    PgnGame game;
+    while (next_pgn_game(&worker->cursor, &game)){
+        if (game.result == PGN_NO_RESULT) continue;
+        int plies = replay_pgn_game(&game, worker->max_ply, count_move, worker);
+        worker->games++;
+        if (plies < 0){
+            worker->unreadable++;
+        } else {
+            worker->moves += plies;
+        }
+    }
+    for (int s = 0; s < BUILDER_SHARDS; s++){
+        if (worker->num_pending[s] > 0) flush_shard(worker, s);
+    }
+    return NULL;
+}
+
+// WRITING THE BOOK
+
+static int compare_entries(const void* a, const void* b){
+    const BookWeight* x = a;
+    const BookWeight* y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (int)y->weight - (int)x->weight;
+}
+
+// the moves played in at least min_games games that scored, sorted by key then weight. returns the count, -1 if out of memory
+static long collect_entries(int min_games, BookWeight** out){
+    long count = 0;
+    uint64_t heaviest = 1;
+    for (int s = 0; s < BUILDER_SHARDS; s++){
+        for (size_t i = 0; i <= shards[s].mask; i++){
+            const MoveStat* stat = &shards[s].slots[i];
+            uint64_t score = 2 * (uint64_t)stat->wins + stat->draws;
+            if (stat->games >= (uint32_t)max(min_games, 1) && score > 0){
+                count++;
+                heaviest = max(heaviest, score);
+            }
+        }
+    }
+    BookWeight* entries = malloc(max(count, 1) * sizeof(BookWeight));
+    if (entries == NULL) return -1;
+    long n = 0;
+    for (int s = 0; s < BUILDER_SHARDS; s++){
+        for (size_t i = 0; i <= shards[s].mask; i++){
+            const MoveStat* stat = &shards[s].slots[i];
+            uint64_t score = 2 * (uint64_t)stat->wins + stat->draws;
+            if (stat->games >= (uint32_t)max(min_games, 1) && score > 0){
+                uint64_t weight = heaviest > UINT16_MAX ? score * UINT16_MAX / heaviest : score;
+                entries[n++] = (BookWeight){stat->key, stat->move, (uint16_t)max(weight, 1)};
+            }
+        }
+    }
+    qsort(entries, count, sizeof(BookWeight), compare_entries);
+    *out = entries;
+    return count;
+}
+
+static bool write_book(const char* filename, const BookWeight* entries, long count){
+    FILE* file = fopen(filename, "wb");
+    if (!file){
+        printf("Error opening file\n");
+        return false;
+    }
+    for (long i = 0; i < count; i++){
+        uint8_t bytes[BOOK_ENTRY_SIZE] = {0}; // learn is left 0
+        for (int b = 0; b < 8; b++) bytes[b] = entries[i].key >> (56 - 8 * b);
+        bytes[8] = entries[i].move >> 8;
+        bytes[9] = entries[i].move;
+        bytes[10] = entries[i].weight >> 8;
+        bytes[11] = entries[i].weight;
+        fwrite(bytes, BOOK_ENTRY_SIZE, 1, file);
+    }
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
+
+static void free_shards(){
+    for (int s = 0; s < BUILDER_SHARDS; s++){
+        free(shards[s].slots);
+        pthread_mutex_destroy(&shards[s].lock);
+        shards[s] = (Shard){0};
+    }
+}
+
+/**
+ * Builds a polyglot opening book from PGN files, games without a result are skipped.
+ * @param out_filename The .bin book to write.
+ * @param pgn_filenames The game collections.
+ * @param num_files The number of game collections.
+ * @param options Threads, ply limit, minimum games and memory, see BookBuildOptions.
+ * @return The number of book entries written, or -1 on failure.
+ */
+long build_book(const char* out_filename, const char** pgn_filenames, int num_files, const BookBuildOptions* options){
+    int num_threads = options->threads > 0 ? options->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = max(num_threads, 1);
+    size_t slots = 1024;
+    while (slots * 2 * sizeof(MoveStat) * BUILDER_SHARDS <= ((size_t)max(options->memory_mb, 1) << 20)) slots *= 2;
+    for (int s = 0; s < BUILDER_SHARDS; s++){
+        pthread_mutex_init(&shards[s].lock, NULL);
+        shards[s].slots = calloc(slots, sizeof(MoveStat));
+        shards[s].mask = slots - 1;
+        if (shards[s].slots == NULL){
+            printf("Error allocating %zu MB for move statistics\n", slots * sizeof(MoveStat) * BUILDER_SHARDS >> 20);
+            free_shards();
+            return -1;
+        }
+    }
+    BuildWorker* workers = calloc(num_threads, sizeof(BuildWorker));
+    if (workers == NULL){
+        free_shards();
+        return -1;
+    }
+
+    for (int f = 0; f < num_files; f++){
+        PgnFile pgn;
+        if (!open_pgn(&pgn, pgn_filenames[f])) continue;
+        size_t range = pgn.size / num_threads + 1;
+        for (int t = 0; t < num_threads; t++){
+            memset(&workers[t], 0, sizeof(BuildWorker));
+            workers[t].cursor = pgn_range(&pgn, t * range, (t + 1) * range);
+            workers[t].max_ply = options->max_ply;
+        }
+        for (int t = 0; t < num_threads; t++){
+            if (pthread_create(&workers[t].thread, NULL, build_worker, &workers[t]) != 0){
+                build_worker(&workers[t]);
+                workers[t].thread = 0;
+            }
+        }
+        long games = 0, moves = 0, unreadable = 0;
+        for (int t = 0; t < num_threads; t++){
+            if (workers[t].thread) pthread_join(workers[t].thread, NULL);
+            games += workers[t].games;
+            moves += workers[t].moves;
+            unreadable += workers[t].unreadable;
+        }
+        printf("%s: %ld games, %ld moves counted, %ld games with unreadable moves\n", pgn_filenames[f], games, moves, unreadable);
+        close_pgn(&pgn);
+    }
+    free(workers);
+
+    uint32_t floor = 0;
+    for (int s = 0; s < BUILDER_SHARDS; s++) floor = max(floor, shards[s].floor);
+    if (floor > 0){
+        printf("Moves seen %u times or fewer were dropped from some positions to stay within %d MB\n", floor, options->memory_mb);
+    }
+    BookWeight* entries = NULL;
+    long count = collect_entries(options->min_games, &entries);
+    free_shards();
+    if (count < 0){
+        printf("Error allocating book entries\n");
+        return -1;
+    }
+    bool ok = write_book(out_filename, entries, count);
+    free(entries);
+    if (!ok) return -1;
+    printf("Wrote %ld entries to %s\n", count, out_filename);
+    return count;
+}
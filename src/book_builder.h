@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BUILDER_SHARDS 64 // power of 2, by the top bits of the position key
+#define BUILDER_BATCH 256 // updates a worker gathers for a shard before taking its lock
+#define BUILDER_DEFAULT_MB 256
+#define BUILDER_DEFAULT_MIN_GAMES 3
+
+typedef struct BookBuildOptions {
+    int threads; // 0 for one per core
+    int max_ply; // moves past this many plies into a game are not counted
+    int min_games; // moves played in fewer games are left out of the book
+    int memory_mb; // for the move statistics, rare moves are dropped to stay within it
+} BookBuildOptions;
+
+long build_book(const char* out_filename, const char** pgn_filenames, int num_files, const BookBuildOptions* options);
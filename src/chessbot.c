@@ -0,0 +1,220 @@
+#include "chessbot.h"
+#include "constants.h"
+#include "get_moves.h"
+#include "search.h"
+#include "helpers.h"
+#include "hash_table.h"
+#include "eval.h"
+#include "endgame.h"
+#include "perft.h"
+#include "time_manager.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// LIBRARY API
+// build with gcc -O2 -shared -fPIC -fvisibility=hidden -o libchessbot.so $(ls src/*.c | grep -v main.c) -lpthread -lm. the read only tables are set up
+// once by the first cb_create, every handle owns its own Engine (transposition table, history scores, clock and counters). calls on
+// different handles are safe from different threads and search concurrently, a handle is used by one thread at a time except for
+// cb_stop. with hidden visibility only the CB_API functions are exported, the engine's own symbols stay inside the library
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+struct ChessBot {
+    uint64_t board[BOARD_ARRAY_SIZE];
+    Engine* engine;
+};
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init_tables(){
+    init_eval_tables();
+    init_material_table();
+    initialize_zobrist();
+}
+
+static uint16_t encode_move(const Move* m, const uint64_t* board){
+    int from = __builtin_ctzll(m->mov1 & board[m->pc1]) ^ 7;
+    int to = __builtin_ctzll(m->mov1 & ~board[m->pc1]) ^ 7;
+    int promoted = m->type == PROMOTE ? m->pc2 : m->type == CAPTURE_PROMOTE ? m->pc3 : -1;
+    int promotion = CB_NO_PROMOTION;
+    switch (promoted % 6){
+        case WHITE_KNIGHT: promotion = CB_KNIGHT; break;
+        case WHITE_BISHOP: promotion = CB_BISHOP; break;
+        case WHITE_ROOK: promotion = CB_ROOK; break;
+        case WHITE_QUEEN: promotion = CB_QUEEN; break;
+    }
+    return CB_MOVE(from, to, promotion);
+}
+
+/**
+ * @return a new engine at the starting position, NULL if out of memory
+ */
+ChessBot* cb_create(void){
+    pthread_once(&init_once, init_tables);
+    ChessBot* cb = malloc(sizeof(ChessBot));
+    if (cb == NULL){
+        return NULL;
+    }
+    cb->engine = create_engine();
+    if (cb->engine == NULL){
+        free(cb);
+        return NULL;
+    }
+    cb_set_position(cb, START_FEN);
+    return cb;
+}
+
+void cb_destroy(ChessBot* cb){
+    if (cb == NULL) return;
+    free_engine(cb->engine);
+    free(cb);
+}
+
+/**
+ * @param fen the position, NULL for the starting position
+ * @return 0, or -1 if the FEN does not have one king of each colour (the position is left unchanged)
+ */
+int cb_set_position(ChessBot* cb, const char* fen){
+    uint64_t* board = from_FEN(fen != NULL ? fen : START_FEN);
+    if (__builtin_popcountll(board[WHITE_KING]) != 1 || __builtin_popcountll(board[BLACK_KING]) != 1){
+        free_board(board);
+        return -1;
+    }
+    memcpy(cb->board, board, sizeof(cb->board));
+    free_board(board);
+    return 0;
+}
+
+/**
+ * @param move a legal move in the 16 bit encoding
+ * @return 0, or -1 if the move is not legal in the current position
+ */
+int cb_apply_move(ChessBot* cb, uint16_t move){
+    Move movs[MOVES_ARRAY_LENGTH];
+    get_legal_moves(movs, cb->board);
+    for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+        if (encode_move(movptr, cb->board) == move){
+            apply_move(movptr, cb->board);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @param uci a legal move in UCI notation, e.g. "e2e4" or "e7e8q"
+ * @return 0, or -1 if the move is not legal in the current position
+ */
+int cb_apply_uci(ChessBot* cb, const char* uci){
+    Move m;
+    if (!move_from_uci(uci, cb->board, &m)){
+        return -1;
+    }
+    apply_move(&m, cb->board);
+    return 0;
+}
+
+/**
+ * @param moves filled with up to max_moves legal moves
+ * @return the number of legal moves in the position, which may be more than were written
+ */
+int cb_legal_moves(ChessBot* cb, uint16_t* moves, int max_moves){
+    Move movs[MOVES_ARRAY_LENGTH];
+    int count = get_legal_moves(movs, cb->board);
+    for (int i = 0; i < count && i < max_moves; i++){
+        moves[i] = encode_move(&movs[i], cb->board);
+    }
+    return count;
+}
+
+/**
+ * Searches the current position with iterative deepening, the position is left unchanged.
+ * @param limits depth and time limits, NULL for CB_DEFAULT_MOVETIME
+ * @param result the best move, score and principal variation of the last completed iteration
+ * @return 0, or -1 if the search could not complete an iteration
+ */
+int cb_search(ChessBot* cb, const CbLimits* limits, CbSearchResult* result){
+    CbLimits none = {0, 0, 0, 0, 0};
+    if (limits == NULL) limits = &none;
+    TimeLimits time_limits = {limits->time_left > 0 ? limits->time_left : -1, limits->increment, limits->moves_to_go, limits->movetime};
+    if (limits->depth <= 0 && time_limits.time_left < 0 && time_limits.movetime <= 0){
+        time_limits.movetime = CB_DEFAULT_MOVETIME;
+    }
+    int max_depth = limits->depth > 0 ? min(limits->depth, MAX_SEARCH_DEPTH) : MAX_SEARCH_DEPTH;
+    uint64_t* board = cb->board;
+    Engine* engine = cb->engine;
+
+    TimeManager tm;
+    init_time_manager(&tm, &time_limits, 0);
+    start_search_clock(engine, tm.hard, NULL);
+    Move legal[MOVES_ARRAY_LENGTH];
+    int num_legal = get_legal_moves(legal, board);
+    bool forced = num_legal == 1;
+    searchResult* best = NULL;
+    int depth = 0;
+    for (int d = 1; d <= max_depth; d++){
+        set_search_depth(engine, d);
+        searchResult* sr = search(engine, board, d, INT16_MIN, INT16_MAX);
+        if (engine->stop && best != NULL){
+            free_search_result(sr);
+            break;
+        }
+        free_search_result(best);
+        best = sr;
+        depth = d;
+        if (engine->stop || best->best_move.type == BOOK_END) break;
+        if (tm.limited && (forced || !time_for_next_iteration(&tm, best, search_elapsed(engine)))) break;
+    }
+    // cleared once the search is over rather than at its start, so a cb_stop sent just before the call still ends it
+    engine->stop = false;
+    // a stop before the first iteration searched any root move leaves it without one, answer with a legal move instead
+    if (best != NULL && best->best_move.type == BOOK_END && num_legal > 0){
+        best->best_move = legal[0];
+    }
+    memset(result, 0, sizeof(CbSearchResult));
+    result->depth = depth;
+    result->time_ms = (int32_t)search_elapsed(engine);
+    result->nodes = get_search_stats(engine).nodes;
+    if (best == NULL){
+        return -1;
+    }
+
+    result->score = (board[INFO] & TURN_BIT) ? best->best_eval : -best->best_eval;
+    Move* line[CB_MAX_PV];
+    for (searchResult* r = best; r != NULL && r->best_move.type != BOOK_END && result->pv_length < CB_MAX_PV; r = r->best_result){
+        result->pv[result->pv_length] = encode_move(&r->best_move, board);
+        apply_move(&r->best_move, board);
+        line[result->pv_length++] = &r->best_move;
+    }
+    for (int i = result->pv_length - 1; i >= 0; i--){
+        apply_move(line[i], board);
+    }
+    result->best_move = result->pv_length > 0 ? result->pv[0] : CB_NO_MOVE;
+    result->ponder_move = result->pv_length > 1 ? result->pv[1] : CB_NO_MOVE;
+    free_search_result(best);
+    return 0;
+}
+
+/**
+ * Stops the running search from another thread, cb_search then returns its last completed iteration. A stop sent just before
+ * cb_search is called ends that search.
+ */
+void cb_stop(ChessBot* cb){
+    cb->engine->stop = true;
+}
+
+/**
+ * @return the static evaluation in centipawns from the side to move's point of view
+ */
+int cb_evaluate(ChessBot* cb){
+    int eval = evaluate(cb->board);
+    return (cb->board[INFO] & TURN_BIT) ? eval : -eval;
+}
+
+/**
+ * @return the number of leaf nodes of the legal move tree of the given depth
+ */
+uint64_t cb_perft(ChessBot* cb, int depth){
+    return perft(cb->board, depth);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+
+// C API of libchessbot.so, for embedding the engine in another process (the Python controller loads it with ctypes). every function
+// works on an engine handle and reports through return values and caller owned structs, there are no static buffers or strings to
+// free. moves are 16 bit: from square | to square << 6 | promotion << 12, squares numbered a1 = 0, b1 = 1, ... h8 = 63
+
+#define CB_MAX_PV 64
+#define CB_API __attribute__((visibility("default"))) // exported when the library is built with -fvisibility=hidden
+
+enum CB_PROMOTION {
+    CB_NO_PROMOTION,
+    CB_KNIGHT,
+    CB_BISHOP,
+    CB_ROOK,
+    CB_QUEEN
+};
+
+#define CB_MOVE(from, to, promotion) ((uint16_t)((from) | (to) << 6 | (promotion) << 12))
+#define CB_MOVE_FROM(move) ((move) & 63)
+#define CB_MOVE_TO(move) (((move) >> 6) & 63)
+#define CB_MOVE_PROMOTION(move) ((move) >> 12)
+#define CB_NO_MOVE 0
+
+typedef struct ChessBot ChessBot; // opaque engine handle
+
+// limits of one search, zero for unused fields. with none set the search gets CB_DEFAULT_MOVETIME
+typedef struct CbLimits {
+    int32_t depth;
+    int32_t movetime; // ms
+    int32_t time_left; // ms on the side to move's clock
+    int32_t increment; // ms
+    int32_t moves_to_go;
+} CbLimits;
+
+#define CB_DEFAULT_MOVETIME 500
+
+typedef struct CbSearchResult {
+    uint16_t best_move; // CB_NO_MOVE when the side to move is mated or stalemated
+    uint16_t ponder_move;
+    int32_t score; // centipawns from the side to move's point of view
+    int32_t depth; // of the last completed iteration
+    int32_t time_ms;
+    uint64_t nodes;
+    int32_t pv_length;
+    uint16_t pv[CB_MAX_PV];
+} CbSearchResult;
+
+CB_API ChessBot* cb_create(void);
+CB_API void cb_destroy(ChessBot* cb);
+CB_API int cb_set_position(ChessBot* cb, const char* fen);
+CB_API int cb_apply_move(ChessBot* cb, uint16_t move);
+CB_API int cb_apply_uci(ChessBot* cb, const char* uci);
+CB_API int cb_legal_moves(ChessBot* cb, uint16_t* moves, int max_moves);
+CB_API int cb_search(ChessBot* cb, const CbLimits* limits, CbSearchResult* result);
+CB_API void cb_stop(ChessBot* cb);
+CB_API int cb_evaluate(ChessBot* cb);
+CB_API uint64_t cb_perft(ChessBot* cb, int depth);
@@ -5,9 +5,9 @@
 #define TURN_BIT UINT64_C(0b10)
 #define A8 UINT64_C(0x8000000000000000)
 
-#define EXACT = 0
-#define UPPER_BOUND = 1
-#define LOWER_BOUND = 2
+#define EXACT 0
+#define UPPER_BOUND 1
+#define LOWER_BOUND 2
 
 // RANK AND FILES
 enum RANK_MASKS{
@@ -33,9 +33,10 @@ enum FILE_MASKS{
 };
 
 // PIEQCE SQUARE TABLES
-extern const int16_t mg_piece_table[];
-extern const int16_t eg_piece_table[];  
-extern const int16_t mg_to_eg_values[];
+// writable so tuned values can be loaded at startup, see load_eval_params
+extern int16_t mg_piece_table[];
+extern int16_t eg_piece_table[];  
+extern int16_t mg_to_eg_values[];
 
 // MOVE GENERATION
 extern const uint64_t KING_MOVES[];  
@@ -72,9 +73,14 @@ enum PIECE_INDEX{
   WHITE_PCS,
   BLACK_PCS,
   INFO,
+  MATERIAL, // material key, see material_count
   BOARD_ARRAY_SIZE
 };
 
+// MATERIAL KEY
+// board[MATERIAL] packs the number of each piece into 4 bits, so equal keys mean equal material. kept up to date by apply_move
+#define material_count(key, pc) (((key) >> ((pc) << 2)) & 15)
+
 enum CASTLING_RIGHTS{
   WHITE_KINGSIDE_SPACE = UINT64_C(0b110),
   WHITE_QUEENSIDE_SPACE = UINT64_C(0b01110000),
@@ -82,7 +88,7 @@ enum CASTLING_RIGHTS{
   BLACK_QUEENSIDE_SPACE = UINT64_C(0b01110000) << 56,
 
   WHITE_KINGSIDE_ATTACKED = UINT64_C(0b1110),
-  WHITE_QUEENSIDE_ATTACKED = UINT64_C(0b10111000),
+  WHITE_QUEENSIDE_ATTACKED = UINT64_C(0b00111000),
   BLACK_KINGSIDE_ATTACKED = UINT64_C(0b1110) << 56,
   BLACK_QUEENSIDE_ATTACKED = UINT64_C(0b00111000) << 56,
 
@@ -6,7 +6,7 @@ const uint64_t RANKS[] = {RANK_1,RANK_2,RANK_3,RANK_4,RANK_5,RANK_6,RANK_7,RANK_
 const uint64_t FILES[] = {FILE_H,FILE_G,FILE_F,FILE_E,FILE_D,FILE_C,FILE_B,FILE_A};
 
 // pc sq tables
-const int16_t mg_piece_table[] = {
+int16_t mg_piece_table[] = {
     // White Pawn
     82,   82,   82,   82,   82,   82,   82,   82,    
     180,  216,  143,  177,  150,  208,  116,   71,    
@@ -139,7 +139,7 @@ const int16_t mg_piece_table[] = {
     -65,   23,   16,  -15,  -56,  -34,    2,   13
   };
 
-const int16_t eg_piece_table[] = {
+int16_t eg_piece_table[] = {
     // White Pawn
     94,   94,   94,   94,   94,   94,   94,   94,    
     272,  267,  252,  228,  241,  226,  259,  281,    
@@ -272,7 +272,7 @@ const int16_t eg_piece_table[] = {
     -74,  -35,  -18,  -18,  -11,   15,    4,  -17,
   };
 
-const int16_t mg_to_eg_values[] = {0,0,2,2,4,8,0,0,2,2,4,8};
+int16_t mg_to_eg_values[] = {0,0,2,2,4,8,0,0,2,2,4,8};
 
 // helpers
 const char* SQUARES[64] = {
@@ -317,7 +317,7 @@ const char MOVE_TYPES[4][17] = {
 };
 
 // move gen
-const unsigned long long KING_MOVES[] = {
+const uint64_t KING_MOVES[] = {
     0x0000000000000302, 0x0000000000000705, 0x0000000000000e0a, 0x0000000000001c14, 0x0000000000003828, 0x0000000000007050, 0x000000000000e0a0, 0x000000000000c040, 
     0x0000000000030203, 0x0000000000070507, 0x00000000000e0a0e, 0x00000000001c141c, 0x0000000000382838, 0x0000000000705070, 0x0000000000e0a0e0, 0x0000000000c040c0,
     0x0000000003020300, 0x0000000007050700, 0x000000000e0a0e00, 0x000000001c141c00, 0x0000000038283800, 0x0000000070507000, 0x00000000e0a0e000, 0x00000000c040c000, 
@@ -328,7 +328,7 @@ const unsigned long long KING_MOVES[] = {
     0x0203000000000000, 0x0507000000000000, 0x0a0e000000000000, 0x141c000000000000, 0x2838000000000000, 0x5070000000000000, 0xa0e0000000000000, 0x40c0000000000000,  
   };
   
-const unsigned long long KNIGHT_MOVES[] = {
+const uint64_t KNIGHT_MOVES[] = {
     0x0000000000020400, 0x0000000000050800, 0x00000000000a1100, 0x0000000000142200, 0x0000000000284400, 0x0000000000508800, 0x0000000000a01000, 0x0000000000402000,
     0x0000000002040004, 0x0000000005080008, 0x000000000a110011, 0x0000000014220022, 0x0000000028440044, 0x0000000050880088, 0x00000000a0100010, 0x0000000040200020,
     0x0000000204000402, 0x0000000508000805, 0x0000000a1100110a, 0x0000001422002214, 0x0000002844004428, 0x0000005088008850, 0x000000a0100010a0, 0x0000004020002040,
@@ -406,7 +406,7 @@ const unsigned char SLIDING_MOVES[] = {
     0x2,0x5,0xa,0x14,0x28,0x50,0xa0,0x40
 };
 
-const unsigned long long DIAGS_UP[] = {
+const uint64_t DIAGS_UP[] = {
     0,
     0x102,
     0x10204,
@@ -424,7 +424,7 @@ const unsigned long long DIAGS_UP[] = {
     0
   };
     
-const unsigned long long DIAGS_DOWN[] = {
+const uint64_t DIAGS_DOWN[] = {
     0,
     0x8040,
     0x804020,
@@ -0,0 +1,157 @@
+#include "endgame.h"
+#include "constants.h"
+#include "helpers.h"
+#include <stdlib.h>
+#include <string.h>
+
+// MATERIAL TABLE
+// maps material signatures (board[MATERIAL]) of trivial endgames to specialized evals or draw scale factors. the tapered piece square
+// eval has no idea that KR-K is a win it must drive towards the edge or that KB-K is a dead draw, so search wanders in these endings
+
+#define MATERIAL_TABLE_SIZE 128 // power of 2, well above the number of registered signatures
+
+static MaterialEntry material_table[MATERIAL_TABLE_SIZE];
+
+// piece values used by the specialized evals, indexed like a side's pieces
+static const int16_t ENDGAME_PIECE_VALUES[6] = {100, 320, 330, 500, 1000, 0};
+
+// SQUARE HELPERS
+// squares are bit indices, bit 0 is h1
+
+static inline int sq_file(int sq){ return 7 - (sq & 7); } // 0 = a file
+static inline int sq_rank(int sq){ return sq >> 3; }
+
+#define DARK_SQUARES 0x55AA55AA55AA55AAULL // a1, c1, ... where (file + rank) is even
+
+static inline int king_distance(int a, int b){
+    return max(abs(sq_file(a) - sq_file(b)), abs(sq_rank(a) - sq_rank(b)));
+}
+
+// 0 on the edge, 3 in the centre
+static inline int edge_distance(int sq){
+    return min(min(sq_file(sq), 7 - sq_file(sq)), min(sq_rank(sq), 7 - sq_rank(sq)));
+}
+
+// bonus for the strong king closing in on the weak one
+static inline int push_close(int strong_king, int weak_king){
+    return 140 - 20 * king_distance(strong_king, weak_king);
+}
+
+static int material_value(const uint64_t* board, int side){
+    int value = 0;
+    for (int pc = WHITE_PAWN; pc < WHITE_KING; pc++){
+        value += __builtin_popcountll(board[side + pc]) * ENDGAME_PIECE_VALUES[pc];
+    }
+    return value;
+}
+
+// SPECIALIZED EVALS
+// all return scores from white's point of view like evaluate
+
+// KQ-K, KR-K, KBB-K with bishops on both colours: mate is forced, drive the weak king to the edge with the strong king nearby
+static int16_t eval_KXK(const uint64_t* board, int strong_side){
+    int weak_side = BLACK_PAWN - strong_side;
+    int strong_king = __builtin_ctzll(board[strong_side + WHITE_KING]);
+    int weak_king = __builtin_ctzll(board[weak_side + WHITE_KING]);
+    int score = KNOWN_WIN + material_value(board, strong_side) + 30 * (3 - edge_distance(weak_king)) + push_close(strong_king, weak_king);
+    return strong_side == WHITE_PAWN ? score : -score;
+}
+
+// KBB-K: two bishops on the same colour can never cover the corner's other colour, a dead draw
+static int16_t eval_KBBK(const uint64_t* board, int strong_side){
+    uint64_t bishops = board[strong_side + WHITE_BISHOP];
+    if ((bishops & DARK_SQUARES) == 0 || (bishops & ~DARK_SQUARES) == 0) return 0;
+    return eval_KXK(board, strong_side);
+}
+
+// KBN-K: mate is only possible in a corner of the bishop's colour, so drive the weak king there
+static int16_t eval_KBNK(const uint64_t* board, int strong_side){
+    int weak_side = BLACK_PAWN - strong_side;
+    int strong_king = __builtin_ctzll(board[strong_side + WHITE_KING]);
+    int weak_king = __builtin_ctzll(board[weak_side + WHITE_KING]);
+    int bishop = __builtin_ctzll(board[strong_side + WHITE_BISHOP]);
+
+    // a1 and h8 are dark, (file + rank) is even on dark squares
+    int dark = ((sq_file(bishop) + sq_rank(bishop)) & 1) == 0;
+    int corner_distance = dark ? min(king_distance(weak_king, 7), king_distance(weak_king, 56))   // a1, h8
+                               : min(king_distance(weak_king, 0), king_distance(weak_king, 63)); // h1, a8
+    int score = KNOWN_WIN + material_value(board, strong_side) + 40 * (7 - corner_distance) + push_close(strong_king, weak_king);
+    return strong_side == WHITE_PAWN ? score : -score;
+}
+
+// bare kings
+static int16_t eval_draw(const uint64_t* board, int strong_side){
+    (void)board;
+    (void)strong_side;
+    return 0;
+}
+
+// TABLE CONSTRUCTION
+
+// material key of a signature such as "KBNK", the pieces up to the second K belong to the strong side
+static uint64_t signature_key(const char* signature, int strong_side){
+    static const char LETTERS[] = "PNBRQK";
+    uint64_t key = 0;
+    int side = strong_side;
+    for (const char* p = signature; *p; p++){
+        if (*p == 'K' && p != signature){
+            side = BLACK_PAWN - strong_side;
+        }
+        int pc = (int)(strchr(LETTERS, *p) - LETTERS);
+        key += UINT64_C(1) << ((side + pc) << 2);
+    }
+    return key;
+}
+
+static void add_entry(const char* signature, EndgameEval eval, int scale){
+    for (int strong_side = WHITE_PAWN; strong_side <= BLACK_PAWN; strong_side += BLACK_PAWN){
+        uint64_t key = signature_key(signature, strong_side);
+        int idx = (int)((key * 0x9E3779B97F4A7C15ULL) >> 57) & (MATERIAL_TABLE_SIZE - 1);
+        while (material_table[idx].key != 0 && material_table[idx].key != key){
+            idx = (idx + 1) & (MATERIAL_TABLE_SIZE - 1);
+        }
+        material_table[idx].key = key;
+        material_table[idx].eval = eval;
+        material_table[idx].strong_side = strong_side;
+        material_table[idx].scale = scale;
+    }
+}
+
+/**
+ * Registers the known endgame signatures in the material table. Must be called before evaluate.
+ */
+void init_material_table(){
+    memset(material_table, 0, sizeof(material_table));
+    add_entry("KK", eval_draw, 0);
+
+    add_entry("KQK", eval_KXK, SCALE_NORMAL);
+    add_entry("KRK", eval_KXK, SCALE_NORMAL);
+    add_entry("KBBK", eval_KBBK, SCALE_NORMAL);
+    add_entry("KBNK", eval_KBNK, SCALE_NORMAL);
+
+    // no mating material
+    add_entry("KBK", NULL, 0);
+    add_entry("KNK", NULL, 0);
+    add_entry("KNNK", NULL, 0);
+
+    // usually drawn, keep the generic eval's preferences but shrink them
+    add_entry("KBKB", NULL, 4);
+    add_entry("KBKN", NULL, 4);
+    add_entry("KNKN", NULL, 4);
+    add_entry("KRKB", NULL, 16);
+    add_entry("KRKN", NULL, 16);
+}
+
+/**
+ * Looks up a material signature in the material table.
+ * @param key The material key of the position, board[MATERIAL].
+ * @return The matching entry, or NULL if the generic eval applies unchanged.
+ */
+const MaterialEntry* probe_material(uint64_t key){
+    int idx = (int)((key * 0x9E3779B97F4A7C15ULL) >> 57) & (MATERIAL_TABLE_SIZE - 1);
+    while (material_table[idx].key != 0){
+        if (material_table[idx].key == key) return &material_table[idx];
+        idx = (idx + 1) & (MATERIAL_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
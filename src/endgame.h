@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+
+#define KNOWN_WIN 10000
+#define SCALE_NORMAL 64 // scale factors are out of 64, applied to the generic eval
+#define MAX_MATERIAL_PIECES 4 // most pieces, kings included, in any registered signature
+
+typedef int16_t (*EndgameEval)(const uint64_t* board, int strong_side);
+
+// what to do with positions of one material signature: a specialized eval replacing the generic one, or a scale factor for the generic eval
+typedef struct MaterialEntry {
+    uint64_t key;
+    EndgameEval eval;
+    int strong_side; // WHITE_PAWN for white, BLACK_PAWN for black, used as an offset to the side's piece indices
+    int scale;
+} MaterialEntry;
+
+void init_material_table();
+const MaterialEntry* probe_material(uint64_t key);
@@ -1,8 +1,28 @@
 #include "eval.h"
 #include "constants.h"
+#include "helpers.h"
+#include "endgame.h"
+#include "bitbase.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
+// nibble lookup tables for evaluate_batch: for each piece and each group of 4 squares (nibble of the bitboard), the summed mg/eg
+// piece square values of every occupancy of those squares, split into low and high bytes so they can be looked up 32 at a time with pshufb
+static uint8_t mg_nibble_lo[12][16][16], mg_nibble_hi[12][16][16];
+static uint8_t eg_nibble_lo[12][16][16], eg_nibble_hi[12][16][16];
+static uint8_t phase_nibble[12][16];
+
+static int16_t evaluate_position(const uint64_t* board){
+    // known endgames replace or scale the generic eval
+    const MaterialEntry* entry = probe_material(board[MATERIAL]);
+    if (entry != NULL && entry->eval != NULL){
+        return entry->eval(board, entry->strong_side);
+    }
 
-int16_t evaluate(const unsigned long long* board){
     int16_t mg_eval = 0;
     int16_t eg_eval = 0;
     int16_t mg_to_eg_counter = 0;
@@ -29,8 +49,282 @@ int16_t evaluate(const unsigned long long* board){
         }
     }
 
-    if (mg_to_eg_counter > 24){
+    int16_t eval = mg_eval;
+    if (mg_to_eg_counter <= 24){
+        eval = (mg_eval * mg_to_eg_counter + eg_eval * (24 - mg_to_eg_counter)) / 24;
+    }
+    if (entry != NULL){
+        return eval * entry->scale / SCALE_NORMAL;
+    }
+    return eval;
+}
+
+int16_t evaluate(const uint64_t* board){
+    // endgames covered by the bitbases: draws are exact, won positions keep the eval's sense of progress on top of KNOWN_WIN
+    int bitbase = probe_bitbase(board);
+    if (bitbase == BB_DRAW){
+        return 0;
+    }
+    int16_t eval = evaluate_position(board);
+    if (bitbase == BB_NONE || abs(eval) >= KNOWN_WIN){
+        return eval;
+    }
+    bool white_wins = (bitbase == BB_WIN) == ((board[INFO] & TURN_BIT) != 0);
+    return white_wins ? KNOWN_WIN + eval : -KNOWN_WIN + eval;
+}
+
+// BATCH EVALUATION
+// positions are stored byte sliced, see BoardBatch, so one 32 byte load holds the same byte of a piece's bitboard for 32 positions
+
+// index into batch->slices of byte b of piece pc's bitboard for position i
+static inline size_t slice_index(int pc, int b, int i){
+    return ((size_t)(i / BATCH_LANES) * 96 + (pc << 3) + b) * BATCH_LANES + (i % BATCH_LANES);
+}
+
+/**
+ * Fills the nibble lookup tables used by evaluate_batch from the piece square tables. Must be called before evaluate_batch.
+ */
+void init_eval_tables(){
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+        for (int nib = 0; nib < 16; nib++){
+            phase_nibble[pc][nib] = __builtin_popcount(nib) * mg_to_eg_values[pc];
+            for (int k = 0; k < 16; k++){
+                int16_t mg = 0;
+                int16_t eg = 0;
+                for (int bit = 0; bit < 4; bit++){
+                    if (nib & (1 << bit)){
+                        mg += mg_piece_table[(pc<<6) + (k<<2) + bit];
+                        eg += eg_piece_table[(pc<<6) + (k<<2) + bit];
+                    }
+                }
+                mg_nibble_lo[pc][k][nib] = (uint16_t)mg & 0xff;
+                mg_nibble_hi[pc][k][nib] = (uint16_t)mg >> 8;
+                eg_nibble_lo[pc][k][nib] = (uint16_t)eg & 0xff;
+                eg_nibble_hi[pc][k][nib] = (uint16_t)eg >> 8;
+            }
+        }
+    }
+}
+
+/**
+ * Allocates an empty batch able to hold at least capacity positions.
+ * @param capacity The minimum number of positions in the batch, rounded up to a multiple of BATCH_LANES.
+ * @return A pointer to the batch, or NULL on allocation failure.
+ */
+BoardBatch* create_board_batch(int capacity){
+    BoardBatch* batch = malloc(sizeof(BoardBatch));
+    if (!batch) return NULL;
+    batch->count = 0;
+    batch->capacity = (capacity + BATCH_LANES - 1) & ~(BATCH_LANES - 1);
+    // zeroed so the unused tail of the last group of lanes evaluates as an empty board
+    batch->slices = calloc((size_t)batch->capacity * 12 * 8, sizeof(uint8_t));
+    batch->boards = malloc((size_t)batch->capacity * BOARD_ARRAY_SIZE * sizeof(uint64_t));
+    if (!batch->slices || !batch->boards){
+        free_board_batch(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+/**
+ * Frees the memory allocated for a batch.
+ * @param batch The batch to be freed.
+ */
+void free_board_batch(BoardBatch* batch){
+    if (batch == NULL) return;
+    free(batch->slices);
+    free(batch->boards);
+    free(batch);
+}
+
+/**
+ * Copies a board into the next free slot of a batch.
+ * @param batch The batch to add to.
+ * @param board The board state.
+ * @return The index of the position in the batch, or -1 if the batch is full.
+ */
+int add_to_batch(BoardBatch* batch, const uint64_t* board){
+    if (batch->count >= batch->capacity) return -1;
+    memcpy(batch->boards + (size_t)batch->count * BOARD_ARRAY_SIZE, board, BOARD_ARRAY_SIZE * sizeof(uint64_t));
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+        for (int b = 0; b < 8; b++){
+            batch->slices[slice_index(pc, b, batch->count)] = (uint8_t)(board[pc] >> (b << 3));
+        }
+    }
+    return batch->count++;
+}
+
+// same tapering as evaluate
+static inline int16_t taper(int16_t mg_eval, int16_t eg_eval, int phase){
+    if (phase > 24){
         return mg_eval;
     }
-    return (mg_eval * mg_to_eg_counter + eg_eval * (24 - mg_to_eg_counter)) / 24;
-}
\ No newline at end of file
+    return (mg_eval * phase + eg_eval * (24 - phase)) / 24;
+}
+
+#ifdef __AVX2__
+static const uint8_t POPCOUNT_NIBBLE[16] = {0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4};
+
+static inline __m256i lookup_nibbles(const uint8_t* table, __m256i nibbles){
+    return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)table)), nibbles);
+}
+
+// 32 positions per iteration, one byte lane each. mg and eg are accumulated as 16 bit lanes, which wrap the same way as the int16_t sums in evaluate.
+// unpacking the low/high byte lookups interleaves the lanes: *_a holds positions 0-7 and 16-23, *_b holds 8-15 and 24-31
+static void evaluate_batch_avx2(const BoardBatch* batch, int16_t* evals){
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    int16_t mg_out[32], eg_out[32];
+    uint8_t phase_out[32], pieces_out[32];
+
+    for (int i = 0; i < batch->count; i += BATCH_LANES){
+        __m256i mg_a = _mm256_setzero_si256(), mg_b = _mm256_setzero_si256();
+        __m256i eg_a = _mm256_setzero_si256(), eg_b = _mm256_setzero_si256();
+        __m256i phase = _mm256_setzero_si256();
+        __m256i pieces = _mm256_setzero_si256();
+
+        for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+            for (int b = 0; b < 8; b++){
+                __m256i bytes = _mm256_loadu_si256((const __m256i*)(batch->slices + slice_index(pc, b, i)));
+                for (int half = 0; half < 2; half++){
+                    int k = (b << 1) + half;
+                    __m256i nibbles = _mm256_and_si256(half ? _mm256_srli_epi16(bytes, 4) : bytes, low_mask);
+                    __m256i mg_lo = lookup_nibbles(mg_nibble_lo[pc][k], nibbles);
+                    __m256i mg_hi = lookup_nibbles(mg_nibble_hi[pc][k], nibbles);
+                    __m256i eg_lo = lookup_nibbles(eg_nibble_lo[pc][k], nibbles);
+                    __m256i eg_hi = lookup_nibbles(eg_nibble_hi[pc][k], nibbles);
+                    phase = _mm256_add_epi8(phase, lookup_nibbles(phase_nibble[pc], nibbles));
+                    pieces = _mm256_add_epi8(pieces, lookup_nibbles(POPCOUNT_NIBBLE, nibbles));
+                    if (pc <= WHITE_KING){
+                        mg_a = _mm256_add_epi16(mg_a, _mm256_unpacklo_epi8(mg_lo, mg_hi));
+                        mg_b = _mm256_add_epi16(mg_b, _mm256_unpackhi_epi8(mg_lo, mg_hi));
+                        eg_a = _mm256_add_epi16(eg_a, _mm256_unpacklo_epi8(eg_lo, eg_hi));
+                        eg_b = _mm256_add_epi16(eg_b, _mm256_unpackhi_epi8(eg_lo, eg_hi));
+                    } else {
+                        mg_a = _mm256_sub_epi16(mg_a, _mm256_unpacklo_epi8(mg_lo, mg_hi));
+                        mg_b = _mm256_sub_epi16(mg_b, _mm256_unpackhi_epi8(mg_lo, mg_hi));
+                        eg_a = _mm256_sub_epi16(eg_a, _mm256_unpacklo_epi8(eg_lo, eg_hi));
+                        eg_b = _mm256_sub_epi16(eg_b, _mm256_unpackhi_epi8(eg_lo, eg_hi));
+                    }
+                }
+            }
+        }
+
+        // put the lanes back in position order
+        _mm256_storeu_si256((__m256i*)mg_out, _mm256_permute2x128_si256(mg_a, mg_b, 0x20));
+        _mm256_storeu_si256((__m256i*)(mg_out + 16), _mm256_permute2x128_si256(mg_a, mg_b, 0x31));
+        _mm256_storeu_si256((__m256i*)eg_out, _mm256_permute2x128_si256(eg_a, eg_b, 0x20));
+        _mm256_storeu_si256((__m256i*)(eg_out + 16), _mm256_permute2x128_si256(eg_a, eg_b, 0x31));
+        _mm256_storeu_si256((__m256i*)phase_out, phase);
+        _mm256_storeu_si256((__m256i*)pieces_out, pieces);
+
+        int lanes = min(BATCH_LANES, batch->count - i);
+        for (int lane = 0; lane < lanes; lane++){
+            if (pieces_out[lane] <= MAX_MATERIAL_PIECES){
+                // few enough pieces to be a known endgame: the material table and the bitbases need the whole board, side to move included
+                evals[i + lane] = evaluate(batch->boards + (size_t)(i + lane) * BOARD_ARRAY_SIZE);
+            } else {
+                evals[i + lane] = taper(mg_out[lane], eg_out[lane], phase_out[lane]);
+            }
+        }
+    }
+}
+#else
+// the byte slices only pay off with vector lookups, one position at a time the stored boards are evaluated directly
+static void evaluate_batch_scalar(const BoardBatch* batch, int16_t* evals){
+    for (int i = 0; i < batch->count; i++){
+        evals[i] = evaluate(batch->boards + (size_t)i * BOARD_ARRAY_SIZE);
+    }
+}
+#endif
+
+/**
+ * Evaluates every position in a batch, giving the same result as calling evaluate on each board.
+ * Uses AVX2 lanes across positions when compiled with AVX2 enabled (-mavx2), otherwise a scalar loop.
+ * @param batch The positions to evaluate.
+ * @param evals Output array with room for batch->count evaluations.
+ */
+void evaluate_batch(const BoardBatch* batch, int16_t* evals){
+#ifdef __AVX2__
+    evaluate_batch_avx2(batch, evals);
+#else
+    evaluate_batch_scalar(batch, evals);
+#endif
+}
+
+// EVAL PARAMETER FILES
+// text file holding the phase weights then the mg and eg piece square tables of each white piece, black tables are the vertical mirror.
+// written by the tuner (see tune.c) and loaded at startup so tuned values don't need to be pasted into data.c
+
+static const char* PARAM_PIECE_NAMES[6] = {"pawn", "knight", "bishop", "rook", "queen", "king"};
+
+/**
+ * Writes the current phase weights and piece square tables to a parameter file.
+ * @param filename The file to write.
+ * @return 1 on success, 0 if the file could not be written.
+ */
+int save_eval_params(const char* filename){
+    FILE* file = fopen(filename, "w");
+    if (!file){
+        printf("Error opening file\n");
+        return 0;
+    }
+    fprintf(file, "phase");
+    for (int pc = WHITE_PAWN; pc <= WHITE_KING; pc++){
+        fprintf(file, " %d", mg_to_eg_values[pc]);
+    }
+    fprintf(file, "\n");
+    for (int stage = 0; stage < 2; stage++){
+        const int16_t* table = stage == 0 ? mg_piece_table : eg_piece_table;
+        for (int pc = WHITE_PAWN; pc <= WHITE_KING; pc++){
+            fprintf(file, "\n%s %s\n", stage == 0 ? "mg" : "eg", PARAM_PIECE_NAMES[pc]);
+            for (int sq = 0; sq < 64; sq++){
+                fprintf(file, "%5d%s", table[(pc<<6) + sq], (sq & 7) == 7 ? "\n" : ",");
+            }
+        }
+    }
+    fclose(file);
+    return 1;
+}
+
+/**
+ * Loads phase weights and piece square tables from a parameter file written by save_eval_params, then rebuilds the batch eval tables.
+ * The current tables are left untouched if the file is missing or malformed.
+ * @param filename The file to read.
+ * @return 1 on success, 0 on failure.
+ */
+int load_eval_params(const char* filename){
+    FILE* file = fopen(filename, "r");
+    if (!file){
+        printf("Error opening file\n");
+        return 0;
+    }
+    int16_t phase[6];
+    int16_t tables[2][6][64];
+    char stage_name[8], piece_name[8];
+    int ok = fscanf(file, " phase %hd %hd %hd %hd %hd %hd", &phase[0], &phase[1], &phase[2], &phase[3], &phase[4], &phase[5]) == 6;
+    for (int stage = 0; ok && stage < 2; stage++){
+        for (int pc = WHITE_PAWN; ok && pc <= WHITE_KING; pc++){
+            ok = fscanf(file, " %7s %7s", stage_name, piece_name) == 2 &&
+                 strcmp(stage_name, stage == 0 ? "mg" : "eg") == 0 &&
+                 strcmp(piece_name, PARAM_PIECE_NAMES[pc]) == 0;
+            for (int sq = 0; ok && sq < 64; sq++){
+                ok = fscanf(file, " %hd ,", &tables[stage][pc][sq]) == 1;
+            }
+        }
+    }
+    fclose(file);
+    if (!ok){
+        printf("Malformed parameter file %s\n", filename);
+        return 0;
+    }
+
+    for (int pc = WHITE_PAWN; pc <= WHITE_KING; pc++){
+        mg_to_eg_values[pc] = mg_to_eg_values[pc + BLACK_PAWN] = phase[pc];
+        for (int sq = 0; sq < 64; sq++){
+            mg_piece_table[(pc<<6) + sq] = mg_piece_table[((pc + BLACK_PAWN)<<6) + (sq ^ 56)] = tables[0][pc][sq];
+            eg_piece_table[(pc<<6) + sq] = eg_piece_table[((pc + BLACK_PAWN)<<6) + (sq ^ 56)] = tables[1][pc][sq];
+        }
+    }
+    init_eval_tables();
+    return 1;
+}
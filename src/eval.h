@@ -1,4 +1,22 @@
 #pragma once
 #include <stdint.h>
 
-int16_t evaluate(const unsigned long long* board);
\ No newline at end of file
+#define BATCH_LANES 32
+
+// structure-of-arrays batch of positions for evaluate_batch, stored byte sliced in blocks of BATCH_LANES positions:
+// within a block, the 32 bytes at ((pc << 3) + b) * BATCH_LANES hold byte b of the bitboard of piece pc for each position in the block
+typedef struct BoardBatch {
+    int count;
+    int capacity;
+    uint8_t* slices;
+    uint64_t* boards; // a copy of each whole board, BOARD_ARRAY_SIZE words apart, for positions evaluate has to see in full
+} BoardBatch;
+
+int16_t evaluate(const uint64_t* board);
+void init_eval_tables();
+BoardBatch* create_board_batch(int capacity);
+void free_board_batch(BoardBatch* batch);
+int add_to_batch(BoardBatch* batch, const uint64_t* board);
+void evaluate_batch(const BoardBatch* batch, int16_t* evals);
+int save_eval_params(const char* filename);
+int load_eval_params(const char* filename);
@@ -14,7 +14,7 @@
 
 // GET [PIECE] ATTACKS
 // used for pieces that have a complicated function for getting attacking squares (bishops, rooks, and queens basically, but queens can steal rook and bishop implementation)
-unsigned long long get_white_rook_attacks(const unsigned long long* board, unsigned long long rook){
+unsigned long long get_white_rook_attacks(const uint64_t* board, unsigned long long rook){
     // uses a lookup table of legal sliding rook moves to get legal moves in O(1) time
     // the bit postiions of the pieces in the way are read as an 8 bit integer (8 squares that a rook can move to/from horizontally and vertically)
     // anti_diag mask is used to transpose the board state to calcualte vertical moves as if they were horiztonal
@@ -36,7 +36,7 @@ unsigned long long get_white_rook_attacks(const unsigned long long* board, unsig
     return attacks & ~board[WHITE_PCS];
 }
 
-unsigned long long get_black_rook_attacks(const unsigned long long* board, unsigned long long rook){
+unsigned long long get_black_rook_attacks(const uint64_t* board, unsigned long long rook){
     // see get_white_rook_attacks
     static const unsigned long long anti_diag = 0x8040201008040201;
     int pos = __builtin_ctzll(rook);
@@ -56,7 +56,7 @@ unsigned long long get_black_rook_attacks(const unsigned long long* board, unsig
     return attacks & ~board[BLACK_PCS];
 }
 
-unsigned long long get_white_bishop_attacks(const unsigned long long* board, unsigned long long bishop){
+unsigned long long get_white_bishop_attacks(const uint64_t* board, unsigned long long bishop){
     // in the future i want to implement a similar lookup table strategy as the rook moves
     // for now, uses many bitwise operations to calculate bishop moves in O(1) time
     
@@ -98,7 +98,7 @@ unsigned long long get_white_bishop_attacks(const unsigned long long* board, uns
     return spots;
 }
 
-unsigned long long get_black_bishop_attacks(const unsigned long long* board, unsigned long long bishop){
+unsigned long long get_black_bishop_attacks(const uint64_t* board, unsigned long long bishop){
     // see get_white_bishop_attacks
     unsigned long long up, down, mask, temp, first_pc, spots;
     const unsigned long long whites = board[WHITE_PCS];
@@ -141,7 +141,7 @@ unsigned long long get_black_bishop_attacks(const unsigned long long* board, uns
 // GET ATTACKS
 // Used to determine if king is in check or if castling is legal
 
-unsigned long long get_white_attackers(const unsigned long long* board){
+unsigned long long get_white_attackers(const uint64_t* board){
     unsigned long long attacks = 0;
     attacks |= ((board[WHITE_PAWN] & ~FILE_H) << 7) | ((board[WHITE_PAWN] & ~FILE_A) << 9);
 
@@ -164,7 +164,7 @@ unsigned long long get_white_attackers(const unsigned long long* board){
     return attacks;
 }
 
-unsigned long long get_black_attackers(const unsigned long long* board){
+unsigned long long get_black_attackers(const uint64_t* board){
 
     unsigned long long attacks = 0;
     
@@ -193,7 +193,7 @@ unsigned long long get_black_attackers(const unsigned long long* board){
 // GET LEGAL [PIECE] MOVES
 // similar implementation for each, iterates over all legal moves, seperating capturing moves, promoting moves, empty moves, and capturing and promoting moves
 // fills mov array by calling create_move functions while incrementing movptr to the next empty spot
-void get_white_knight_moves(Move** movptr,const unsigned long long* board){
+void get_white_knight_moves(Move** movptr,const uint64_t* board){
 
     const unsigned long long whites = board[WHITE_PCS];
     const unsigned long long blacks = board[BLACK_PCS];
@@ -222,7 +222,7 @@ void get_white_knight_moves(Move** movptr,const unsigned long long* board){
     }
 }
 
-void get_black_knight_moves(Move** movptr, const unsigned long long* board){
+void get_black_knight_moves(Move** movptr, const uint64_t* board){
     const unsigned long long whites = board[WHITE_PCS];
     const unsigned long long blacks = board[BLACK_PCS];
     unsigned long long knights = board[BLACK_KNIGHT];
@@ -249,7 +249,7 @@ void get_black_knight_moves(Move** movptr, const unsigned long long* board){
     }
 }
 
-void get_white_rook_moves(Move** movptr, const unsigned long long* board){
+void get_white_rook_moves(Move** movptr, const uint64_t* board){
     unsigned long long rooks = board[WHITE_ROOK];
 
     unsigned long long rook, spot, taken_piece; 
@@ -281,7 +281,7 @@ void get_white_rook_moves(Move** movptr, const unsigned long long* board){
     }
 }
 
-void get_black_rook_moves(Move** movptr, const unsigned long long* board){
+void get_black_rook_moves(Move** movptr, const uint64_t* board){
     unsigned long long rooks = board[BLACK_ROOK];
 
     unsigned long long rook, spot, taken_piece; 
@@ -311,7 +311,7 @@ void get_black_rook_moves(Move** movptr, const unsigned long long* board){
     }
     }
 
-void get_white_bishop_moves(Move** movptr, const unsigned long long* board){
+void get_white_bishop_moves(Move** movptr, const uint64_t* board){
     const unsigned long long blacks = board[BLACK_PCS];
     unsigned long long bishops = board[WHITE_BISHOP];
     unsigned long long bishop, spot, taken_piece;
@@ -340,7 +340,7 @@ void get_white_bishop_moves(Move** movptr, const unsigned long long* board){
     }
 }
 
-void get_black_bishop_moves(Move** movptr,const unsigned long long* board){
+void get_black_bishop_moves(Move** movptr,const uint64_t* board){
     const unsigned long long whites = board[WHITE_PCS];
     unsigned long long bishops = board[BLACK_BISHOP];
 
@@ -370,7 +370,7 @@ void get_black_bishop_moves(Move** movptr,const unsigned long long* board){
     }
 }
 
-void get_white_pawn_moves(Move** movptr,const unsigned long long* board){
+void get_white_pawn_moves(Move** movptr,const uint64_t* board){
     const unsigned long long whites = board[WHITE_PCS];
     const unsigned long long blacks = board[BLACK_PCS];
     unsigned long long pawns = board[WHITE_PAWN];
@@ -437,13 +437,13 @@ void get_white_pawn_moves(Move** movptr,const unsigned long long* board){
         }
     }
     // taking en passent 
-    unsigned long long en_passent_take_left = ((pawns << 9) & board[INFO] & ~RANK_1);
+    unsigned long long en_passent_take_left = ((pawns << 9) & board[INFO] & RANK_6 & ~FILE_H);
     if (en_passent_take_left){
         *movptr = create_move2(*movptr,WHITE_PAWN,en_passent_take_left | (en_passent_take_left >> 9),
                                     BLACK_PAWN,en_passent_take_left >> 8,info_xor,CAPTURE);
     }
     
-    unsigned long long en_passent_take_right = ((pawns << 7) & board[INFO] & ~RANK_1);
+    unsigned long long en_passent_take_right = ((pawns << 7) & board[INFO] & RANK_6 & ~FILE_A);
     if (en_passent_take_right){
         *movptr = create_move2(*movptr,WHITE_PAWN,en_passent_take_right | (en_passent_take_right >> 7),
                                     BLACK_PAWN,en_passent_take_right >> 8,info_xor,CAPTURE);
@@ -451,7 +451,7 @@ void get_white_pawn_moves(Move** movptr,const unsigned long long* board){
 
 }
 
-void get_black_pawn_moves(Move** movptr,const unsigned long long* board){
+void get_black_pawn_moves(Move** movptr,const uint64_t* board){
     const unsigned long long whites = board[WHITE_PCS];
     const unsigned long long blacks = board[BLACK_PCS];
     unsigned long long pawns = board[BLACK_PAWN];
@@ -469,7 +469,7 @@ void get_black_pawn_moves(Move** movptr,const unsigned long long* board){
             *movptr = create_move2(*movptr,BLACK_PAWN,spot,BLACK_BISHOP,promotion_sq,info_xor,PROMOTE);
             *movptr = create_move2(*movptr,BLACK_PAWN,spot,BLACK_ROOK,promotion_sq,info_xor,PROMOTE);
         } else {
-            *movptr = create_move1(*movptr,WHITE_PAWN,spot,info_xor);
+            *movptr = create_move1(*movptr,BLACK_PAWN,spot,info_xor);
         }
     }
     for (unsigned long long two_step = ((pawns & RANK_7) >> 16) & ~((pcs) | (pcs >> 8)); two_step; two_step &= (two_step - 1)){
@@ -514,27 +514,27 @@ void get_black_pawn_moves(Move** movptr,const unsigned long long* board){
     }
 
     // taking en passent 
-    unsigned long long en_passent_take_left = ((pawns >> 7) & board[INFO] & ~RANK_1);
+    unsigned long long en_passent_take_left = ((pawns >> 7) & board[INFO] & RANK_3 & ~FILE_H);
     if (en_passent_take_left){
         *movptr = create_move2(*movptr,BLACK_PAWN,en_passent_take_left | (en_passent_take_left << 7),
                                    WHITE_PAWN,en_passent_take_left << 8,info_xor,CAPTURE);
     }
     
-    unsigned long long en_passent_take_right = ((pawns >> 9) & board[INFO] & ~RANK_1);
+    unsigned long long en_passent_take_right = ((pawns >> 9) & board[INFO] & RANK_3 & ~FILE_A);
     if (en_passent_take_right){
         *movptr = create_move2(*movptr,BLACK_PAWN,en_passent_take_right | (en_passent_take_right << 9),
                                    WHITE_PAWN,en_passent_take_right << 8,info_xor,CAPTURE);
     }
 }
 
-void get_white_king_moves(Move** movptr,const unsigned long long* board){
+void get_white_king_moves(Move** movptr,const uint64_t* board){
     const unsigned long long whites = board[WHITE_PCS];
     const unsigned long long blacks = board[BLACK_PCS];
     unsigned long long king = board[WHITE_KING];
     unsigned long long moves = KING_MOVES[__builtin_ctzll(king)] & ~whites;
     unsigned long long move, taken_piece;
 
-    const unsigned long long info_xor = TURN_BIT | ((WHITE_KINGSIDE_RIGHT | WHITE_QUEENSIDE_RIGHT) & board[INFO]);
+    const unsigned long long info_xor = TURN_BIT | ((WHITE_KINGSIDE_RIGHT | WHITE_QUEENSIDE_RIGHT) & board[INFO]) | (board[INFO] & ~RANK_1 & ~RANK_8);
 
     for(unsigned long long clear_moves = moves & ~blacks; clear_moves; clear_moves &= (clear_moves - 1)){
         move = (clear_moves & (-clear_moves)) | king;
@@ -570,7 +570,7 @@ void get_white_king_moves(Move** movptr,const unsigned long long* board){
 
 }
 
-void get_black_king_moves(Move** movptr,const unsigned long long* board){
+void get_black_king_moves(Move** movptr,const uint64_t* board){
     const unsigned long long whites = board[WHITE_PCS];
     const unsigned long long blacks = board[BLACK_PCS];
     unsigned long long king = board[BLACK_KING];
@@ -578,7 +578,7 @@ void get_black_king_moves(Move** movptr,const unsigned long long* board){
     unsigned long long move, taken_piece;
 
 
-    const unsigned long long info_xor = TURN_BIT | ((BLACK_KINGSIDE_RIGHT | BLACK_QUEENSIDE_RIGHT) & board[INFO]);
+    const unsigned long long info_xor = TURN_BIT | ((BLACK_KINGSIDE_RIGHT | BLACK_QUEENSIDE_RIGHT) & board[INFO]) | (board[INFO] & ~RANK_1 & ~RANK_8);
 
     for(unsigned long long clear_moves = moves & ~whites; clear_moves; clear_moves &= clear_moves - 1){
         move = (clear_moves & (-clear_moves)) | king;
@@ -593,7 +593,7 @@ void get_black_king_moves(Move** movptr,const unsigned long long* board){
             }
         }        
     }
-    unsigned long long attacks;
+    unsigned long long attacks = 0;
     if ((board[INFO] & BLACK_KINGSIDE_RIGHT) && 
         ((BLACK_KINGSIDE_SPACE & (whites | blacks)) == 0) &&
         (board[BLACK_ROOK] & FILE_H & RANK_8)){
@@ -614,7 +614,7 @@ void get_black_king_moves(Move** movptr,const unsigned long long* board){
     }
 }
 
-void get_white_queen_moves(Move** movptr, const unsigned long long* board){
+void get_white_queen_moves(Move** movptr, const uint64_t* board){
     const unsigned long long blacks = board[BLACK_PCS];
     unsigned long long queens = board[WHITE_QUEEN];
     unsigned long long queen, spot, taken_piece;
@@ -642,7 +642,7 @@ void get_white_queen_moves(Move** movptr, const unsigned long long* board){
     }
 }
 
-void get_black_queen_moves(Move** movptr, const unsigned long long* board){
+void get_black_queen_moves(Move** movptr, const uint64_t* board){
     const unsigned long long whites = board[WHITE_PCS];
     unsigned long long queens = board[BLACK_QUEEN];
     unsigned long long queen, spot, taken_piece;
@@ -695,7 +695,7 @@ int compare_moves(const void* a, const void* b){
 }
 
 // white side interfacing function
-void get_white_moves(Move* movs,const unsigned long long* board){
+void get_white_moves(Move* movs,const uint64_t* board){
     Move* movptr = movs;
     get_white_queen_moves(&movptr,board);
     get_white_rook_moves(&movptr,board);
@@ -710,7 +710,7 @@ void get_white_moves(Move* movs,const unsigned long long* board){
 }
 
 // black side interfacing function
-void get_black_moves(Move* movs, const unsigned long long* board){
+void get_black_moves(Move* movs, const uint64_t* board){
     Move* movptr = movs;
     get_black_queen_moves(&movptr,board);
     get_black_rook_moves(&movptr,board);
@@ -722,4 +722,25 @@ void get_black_moves(Move* movs, const unsigned long long* board){
     
     // apply move ordering
     qsort(movs, movptr-movs, sizeof(Move), compare_moves);
+}
+
+// legal moves for the side to move: pseudo legal moves that leave the own king in check are dropped, the list is BOOK_END terminated
+int get_legal_moves(Move* movs, uint64_t* board){
+    bool white = board[INFO] & TURN_BIT;
+    if (white){
+        get_white_moves(movs, board);
+    } else {
+        get_black_moves(movs, board);
+    }
+    int count = 0;
+    for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+        apply_move(movptr, board);
+        bool illegal = white ? (board[WHITE_KING] & get_black_attackers(board)) : (board[BLACK_KING] & get_white_attackers(board));
+        apply_move(movptr, board);
+        if (!illegal){
+            movs[count++] = *movptr;
+        }
+    }
+    movs[count].type = BOOK_END;
+    return count;
 }
\ No newline at end of file
@@ -17,7 +17,14 @@ typedef struct Move {
     uint64_t info;
 } Move;
   
-unsigned long long get_white_attackers(const unsigned long long* board);
-unsigned long long get_black_attackers(const unsigned long long* board);
-void get_black_moves(Move* movs, const unsigned long long* board);
-void get_white_moves(Move* movs,const unsigned long long* board);
\ No newline at end of file
+unsigned long long get_white_rook_attacks(const uint64_t* board, unsigned long long rook);
+unsigned long long get_black_rook_attacks(const uint64_t* board, unsigned long long rook);
+unsigned long long get_white_bishop_attacks(const uint64_t* board, unsigned long long bishop);
+unsigned long long get_black_bishop_attacks(const uint64_t* board, unsigned long long bishop);
+unsigned long long get_white_attackers(const uint64_t* board);
+unsigned long long get_black_attackers(const uint64_t* board);
+void get_white_knight_moves(Move** movptr, const uint64_t* board);
+void get_black_knight_moves(Move** movptr, const uint64_t* board);
+void get_black_moves(Move* movs, const uint64_t* board);
+void get_white_moves(Move* movs,const uint64_t* board);
+int get_legal_moves(Move* movs, uint64_t* board);
\ No newline at end of file
@@ -5,9 +5,15 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // CUSTOM HASH TABLE IMPLEMENTATION
-// uses 64 bit hashses, first indexed in the array with the least significant 16 bits, then compared with the full 64 along a linked list with head in the array
+// uses 64 bit hashses, first indexed in the array with the least significant bits, then compared with the full 64 along the entries of the bucket
 // stores previously found best move for a given lookup position. 
 // called a transposition table because it is primarily used to skip searching when the same board positions shows up again from a different series of moves, this is called a transposition
 
@@ -44,41 +50,53 @@
 // enpas1 49-54
 // enpas2 55-60
 
-// TRANSTABLE
-Node** TransTable;
-
 // HASHING IMPLEMENTATION
-uint64_t xorshift64_state = PRIME; // seed for hashing function
+// the zobrist keys are filled once per process from a fixed seed and only read after that, so every engine and every saved table
+// agrees on the hash of a position. each engine has its own transposition table (see TransTable)
 
 // arrays for hashing function
 static uint64_t zobrist_pc_keys[12][64];
 static uint64_t zobrist_en_pass_keys[8];
 static uint64_t zobrist_info_keys[5];
+static pthread_once_t zobrist_once = PTHREAD_ONCE_INIT;
 
 // creates random numbers to fill hashing arrays
-uint64_t xorshift64() {
-    uint64_t x = xorshift64_state;
+static uint64_t xorshift64(uint64_t* state) {
+    uint64_t x = *state;
     x ^= x << 13;
     x ^= x >> 7;
     x ^= x << 17;
-    return xorshift64_state = x;
+    return *state = x;
 }
 
-// fills hashing arrays
-void initialize_zobrist(){
+static void fill_zobrist_keys(){
+    uint64_t state = PRIME; // seed for hashing function
     for (int pc = 0; pc < 12; pc++){
         for (int i = 0; i < 64; i++){
-            zobrist_pc_keys[pc][i] = xorshift64();
+            zobrist_pc_keys[pc][i] = xorshift64(&state);
         }
     }
     for (int i = 0; i < 8; i++){
-        zobrist_en_pass_keys[i] = xorshift64();
+        zobrist_en_pass_keys[i] = xorshift64(&state);
     }
     for (int i = 0; i < 5; i++){
-        zobrist_info_keys[i] = xorshift64();
+        zobrist_info_keys[i] = xorshift64(&state);
     }
 }
 
+// fills hashing arrays, safe to call from any number of threads and engines
+void initialize_zobrist(){
+    pthread_once(&zobrist_once, fill_zobrist_keys);
+}
+
+/**
+ * @return the first key drawn from the seed, saved files record it to catch a change to how the keys are generated
+ */
+uint64_t zobrist_signature(){
+    initialize_zobrist();
+    return zobrist_pc_keys[0][0];
+}
+
 /**
  * Computes a hash value for the given board state.
  * @param board The board state.
@@ -86,7 +104,7 @@ void initialize_zobrist(){
  */
 uint64_t get_hash(uint64_t* board){
     uint64_t hash = 0;
-    for (int pc = WHITE_PAWN; pc <= INFO; pc++){
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
         for (uint64_t pieces = board[pc]; pieces; pieces &= (pieces - 1)){
             hash ^= zobrist_pc_keys[pc][__builtin_ctzll(pieces)];
         }
@@ -106,32 +124,182 @@ uint64_t get_hash(uint64_t* board){
     return hash;
 }
 
+static inline uint64_t squares_key(int pc, uint64_t squares){
+    uint64_t key = 0;
+    for (; squares; squares &= squares - 1){
+        key ^= zobrist_pc_keys[pc][__builtin_ctzll(squares)];
+    }
+    return key;
+}
+
 /**
- * Initializes the transposition table by allocating memory for the hash table.
+ * Computes the change a move makes to the hash, following apply_move: every square it toggles for a piece, castling right, turn and
+ * en passant square it toggles in the info bits. Making or unmaking the move xors it into the hash of the position.
+ * @param m The move.
+ * @return get_hash of the position after the move xor get_hash of the position before it.
  */
-void initilize_trans_table(){
-    TransTable = malloc(UINT16_MAX * sizeof(Node*)); 
-    for (int i = 0; i < UINT16_MAX; i++){
-        TransTable[i] = NULL;
+uint64_t move_hash_delta(const Move* m){
+    uint64_t promotion_sq = m->type == PROMOTE ? m->mov2 : m->type == CAPTURE_PROMOTE ? m->mov3 : 0;
+    uint64_t delta = squares_key(m->pc1, m->mov1 ^ promotion_sq) ^ squares_key(m->pc2, m->mov2) ^ squares_key(m->pc3, m->mov3);
+    delta ^= (m->info & WHITE_KINGSIDE_RIGHT ? zobrist_info_keys[0] : 0);
+    delta ^= (m->info & WHITE_QUEENSIDE_RIGHT ? zobrist_info_keys[1] : 0);
+    delta ^= (m->info & BLACK_KINGSIDE_RIGHT ? zobrist_info_keys[2] : 0);
+    delta ^= (m->info & BLACK_QUEENSIDE_RIGHT ? zobrist_info_keys[3] : 0);
+    delta ^= (m->info & TURN_BIT ? zobrist_info_keys[4] : 0);
+    // the square that stops being the en passant square and the one that becomes it
+    for (uint64_t en_pass = m->info & ~RANK_1 & ~RANK_8; en_pass; en_pass &= en_pass - 1){
+        delta ^= zobrist_en_pass_keys[__builtin_ctzll(en_pass) % 8];
     }
+    return delta;
+}
+
+// TRANSTABLE
+// a flat array of buckets of TT_BUCKET_SIZE entries, indexed by the low bits of the hash and holding the newest entries first. entries
+// hold no pointers so the table can be placed in shared memory and written by several processes at once without locks: the key is
+// stored xor'd with the data, so an entry torn by two writers fails the key check instead of returning another position's move
+
+static size_t table_bytes(int hash_mb){
+    uint64_t buckets = 1;
+    while (buckets * 2 * TT_BUCKET_SIZE * sizeof(TTEntry) <= (uint64_t)hash_mb << 20) buckets *= 2;
+    return buckets * TT_BUCKET_SIZE * sizeof(TTEntry);
+}
+
+static void set_table_size(TransTable* tt, size_t size){
+    tt->size = size;
+    tt->mask = size / (TT_BUCKET_SIZE * sizeof(TTEntry)) - 1;
+}
+
+// tables of at least a huge page are mapped, on explicit huge pages when the system has them reserved and otherwise aligned to a huge
+// page with a hint for transparent huge pages, so a probe costs one TLB entry per 2 MB instead of per 4 KB. NULL if mapping fails
+static void* map_table(size_t size){
+    if (size < TT_HUGE_PAGE_SIZE) return NULL;
+#ifdef MAP_HUGETLB
+    void* entries = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (entries != MAP_FAILED) return entries;
+#endif
+    uint8_t* raw = mmap(NULL, size + TT_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    uint8_t* aligned = (uint8_t*)(((uintptr_t)raw + TT_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(TT_HUGE_PAGE_SIZE - 1));
+    if (aligned > raw) munmap(raw, aligned - raw);
+    munmap(aligned + size, TT_HUGE_PAGE_SIZE - (aligned - raw));
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+    return aligned;
 }
 
 /**
- * Frees the memory allocated for the transposition table.
+ * Initializes a transposition table in private memory.
+ * @param tt The table.
+ * @param hash_mb Its size, rounded down to a power of two buckets.
+ * @return false if out of memory, the table is then empty and ignores writes.
  */
-void free_trans_table(){
-    if (TransTable == NULL) return; // Null check for safety
-    Node* temp;
-    for (int i = 0; i < UINT16_MAX; i++){
-        Node* next = TransTable[i];
-        while (next != NULL){
-            temp = next->next;
-            free(next);
-            next = temp;
-        }
+bool initilize_trans_table(TransTable* tt, int hash_mb){
+    memset(tt, 0, sizeof(TransTable));
+    set_table_size(tt, table_bytes(hash_mb));
+    tt->entries = map_table(tt->size);
+    tt->mapped = tt->entries != NULL;
+    if (!tt->mapped) tt->entries = calloc(1, tt->size);
+    if (tt->entries == NULL){
+        tt->size = 0;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Places a transposition table in a named POSIX shared memory segment, which the processes attached to the same name share. The
+ * first process to attach read write creates the segment, after that its size is the segment's. The segment outlives the processes,
+ * remove it with rm /dev/shm/<name> (or shm_unlink).
+ * @param tt The table.
+ * @param name The segment, starting with a slash.
+ * @param hash_mb The size of a new segment.
+ * @param read_only Only probe the table, the segment must exist already.
+ * @return false if the segment could not be opened or mapped, the table is then empty and ignores writes.
+ */
+bool attach_shared_trans_table(TransTable* tt, const char* name, int hash_mb, bool read_only){
+    memset(tt, 0, sizeof(TransTable));
+    int fd = shm_open(name, read_only ? O_RDONLY : O_RDWR | O_CREAT, 0600);
+    if (fd < 0){
+        printf("Error opening shared memory %s\n", name);
+        return false;
+    }
+    struct stat st;
+    size_t size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    if (size == 0 && !read_only){
+        size = table_bytes(hash_mb);
+        if (ftruncate(fd, size) != 0) size = 0;
     }
-    free(TransTable);
-    TransTable = NULL; // Avoid dangling pointer
+    // every process has to index the segment with the same number of buckets, a power of two
+    size_t buckets = size / (TT_BUCKET_SIZE * sizeof(TTEntry));
+    if (buckets == 0 || (buckets & (buckets - 1)) || size % (TT_BUCKET_SIZE * sizeof(TTEntry))){
+        printf("Shared memory %s is not a transposition table\n", name);
+        close(fd);
+        return false;
+    }
+    void* entries = mmap(NULL, size, read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (entries == MAP_FAILED){
+        printf("Error mapping shared memory %s\n", name);
+        return false;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(entries, size, MADV_HUGEPAGE); // used when the system allows huge pages for shared memory
+#endif
+    tt->entries = entries;
+    set_table_size(tt, size);
+    tt->mapped = true;
+    tt->shared = true;
+    tt->read_only = read_only;
+    return true;
+}
+
+/**
+ * Replaces a transposition table with the one the options describe.
+ * @return false if it could not be set up, the table is then empty and ignores writes.
+ */
+bool open_trans_table(TransTable* tt, const TableOptions* options){
+    free_trans_table(tt);
+    if (options->shared_name != NULL){
+        return attach_shared_trans_table(tt, options->shared_name, options->hash_mb, options->read_only);
+    }
+    return initilize_trans_table(tt, options->hash_mb);
+}
+
+/**
+ * Empties a private transposition table, for a new game. A shared table is kept, other processes are still using it.
+ */
+void clear_trans_table(TransTable* tt){
+    if (tt->entries != NULL && !tt->shared){
+        memset(tt->entries, 0, tt->size);
+    }
+}
+
+/**
+ * Estimates how full the transposition table is, for the UCI hashfull field.
+ * @return Permille of the entries in use, counted over the first 1000 buckets.
+ */
+int hashfull(const TransTable* tt){
+    if (tt->entries == NULL) return 0;
+    int used = 0;
+    uint64_t buckets = min(tt->mask + 1, 1000);
+    for (uint64_t i = 0; i < buckets * TT_BUCKET_SIZE; i++){
+        used += tt->entries[i].data != 0;
+    }
+    return used * 1000 / (buckets * TT_BUCKET_SIZE);
+}
+
+/**
+ * Frees a transposition table, or detaches it from its shared memory segment.
+ */
+void free_trans_table(TransTable* tt){
+    if (tt->entries == NULL) return; // Null check for safety
+    if (tt->mapped){
+        munmap(tt->entries, tt->size);
+    } else {
+        free(tt->entries);
+    }
+    memset(tt, 0, sizeof(TransTable)); // Avoid dangling pointer
 }
 
 /**
@@ -225,55 +393,124 @@ Move decrypt_move(uint64_t code){
     return m;
 }
 
+// SAVED TABLES
+// a table is saved as its entries behind a header, and loaded back only into a table of the same size with the same entry format and
+// zobrist keys, anything else would look up wrong moves. both ways go through a mapping of the file, so a table of gigabytes is
+// copied by the page cache instead of through stdio buffers
+
+static void fill_file_header(TTFileHeader* header, uint64_t buckets){
+    memset(header, 0, sizeof(TTFileHeader));
+    header->magic = TT_FILE_MAGIC;
+    header->version = TT_FILE_VERSION;
+    header->zobrist_seed = PRIME;
+    header->zobrist_check = zobrist_signature();
+    header->buckets = buckets;
+    header->bucket_size = TT_BUCKET_SIZE;
+    header->entry_size = sizeof(TTEntry);
+}
+
 /**
- * Adds a move to the transposition table.
- * @param in_m The move to be added.
- * @param type The type of the move.
- * @param depth The depth of the search.
- * @param board The board state.
+ * Writes a transposition table to a file, for a warm start with load_trans_table.
+ * @param tt The table, it must not be written to meanwhile.
+ * @param filename The file, replaced if it exists.
+ * @return false if the file could not be written.
  */
-void add_item(Move* in_m, int type, int depth, uint64_t* board){
-    uint64_t hash = get_hash(board);
-    uint16_t index = hash & 0xffff;
-
-    Node* node = TransTable[index];
-    Node* new_node = malloc(sizeof(Node));
-    if (!new_node) return; // Handle memory allocation failure
-
-    new_node->move_code = encrypt_move(in_m);
-    new_node->next = node;
-    new_node->hash = hash;
-    new_node->search_info = depth | (type << 6);
-
-    TransTable[index] = new_node;
-
-    // Trim linked list to MAX_LINKED_LIST length
-    Node* current = new_node;
-    int count = 1;
-    while (current->next != NULL && count < MAX_LINKED_LIST) {
-        current = current->next;
-        count++;
+bool save_trans_table(const TransTable* tt, const char* filename){
+    if (tt->entries == NULL) return false;
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        printf("Error opening file\n");
+        return false;
     }
-    if (current->next != NULL) {
-        Node* temp = current->next;
-        current->next = NULL; // Cut the link
-        while (temp != NULL) {
-            Node* to_free = temp;
-            temp = temp->next;
-            free(to_free); // Free excess nodes
-        }
+    size_t size = sizeof(TTFileHeader) + tt->size;
+    uint8_t* data = ftruncate(fd, size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED){
+        printf("Error writing file %s\n", filename);
+        return false;
+    }
+    fill_file_header((TTFileHeader*)data, tt->mask + 1);
+    memcpy(data + sizeof(TTFileHeader), tt->entries, tt->size);
+    bool ok = msync(data, size, MS_SYNC) == 0;
+    munmap(data, size);
+    if (!ok) printf("Error writing file %s\n", filename);
+    return ok;
+}
+
+/**
+ * Replaces the entries of a transposition table with the ones saved in a file.
+ * @param tt The table, it must not be searched meanwhile.
+ * @param filename A file written by save_trans_table.
+ * @return false, with the table unchanged, if the file cannot be read, was saved with another entry format or zobrist keys, or
+ * holds a table of another size.
+ */
+bool load_trans_table(TransTable* tt, const char* filename){
+    if (tt->entries == NULL || tt->read_only) return false;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        printf("Error opening file\n");
+        return false;
+    }
+    struct stat st;
+    size_t size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    uint8_t* data = size >= sizeof(TTFileHeader) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED){
+        printf("Invalid table file %s\n", filename);
+        return false;
+    }
+
+    const TTFileHeader* header = (const TTFileHeader*)data;
+    TTFileHeader expected;
+    fill_file_header(&expected, tt->mask + 1);
+    bool valid = header->magic == expected.magic && header->version == expected.version && header->zobrist_seed == expected.zobrist_seed
+              && header->zobrist_check == expected.zobrist_check && header->bucket_size == expected.bucket_size
+              && header->entry_size == expected.entry_size;
+    if (!valid){
+        printf("Invalid table file %s\n", filename);
+    } else if (header->buckets != expected.buckets || size != sizeof(TTFileHeader) + tt->size){
+        printf("Table file %s holds %llu MB, set the hash size to match\n", filename,
+            (unsigned long long)((header->buckets * TT_BUCKET_SIZE * sizeof(TTEntry)) >> 20));
+        valid = false;
+    } else {
+        madvise(data, size, MADV_SEQUENTIAL);
+        memcpy(tt->entries, data + sizeof(TTFileHeader), tt->size);
     }
+    munmap(data, size);
+    return valid;
 }
 
-// lookup a board positions in the transposition table 
-Node* query_table(uint64_t* board){
-    if (TransTable == NULL) return NULL; // Null check for safety
-    uint64_t hash = get_hash(board);
-    Node* node = TransTable[hash & 0xffff];
-    while(node != NULL){
-        if (node->hash == hash) return node;
-        node = node->next;
+/**
+ * Adds a move to a transposition table, as the newest entry of its bucket. A read only table is left unchanged.
+ * @param tt The table.
+ * @param in_m The move to be added.
+ * @param type The bound of the search result.
+ * @param depth The depth of the search.
+ * @param hash The position's zobrist hash.
+ */
+void add_item(TransTable* tt, Move* in_m, int type, int depth, uint64_t hash){
+    if (tt->entries == NULL || tt->read_only) return;
+    TTEntry* bucket = tt->entries + (hash & tt->mask) * TT_BUCKET_SIZE;
+    uint64_t data = (encrypt_move(in_m) & TT_MOVE_MASK) << 8 | depth | type << 6;
+
+    // the oldest entry drops out
+    for (int i = TT_BUCKET_SIZE - 1; i > 0; i--){
+        bucket[i] = bucket[i - 1];
     }
-    return NULL;
+    bucket[0].key = hash ^ data;
+    bucket[0].data = data;
 }
 
+// lookup a position by its hash in a transposition table, the newest entry of the position is copied to out
+bool query_table(const TransTable* tt, uint64_t hash, TTEntry* out){
+    if (tt->entries == NULL) return false; // Null check for safety
+    const TTEntry* bucket = tt->entries + (hash & tt->mask) * TT_BUCKET_SIZE;
+    for (int i = 0; i < TT_BUCKET_SIZE; i++){
+        TTEntry entry = bucket[i];
+        if (entry.data != 0 && (entry.key ^ entry.data) == hash){
+            *out = entry;
+            return true;
+        }
+    }
+    return false;
+}
@@ -2,22 +2,73 @@
 #include "constants.h"
 #include "get_moves.h"
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #define PRIME UINT64_C(0x9E3779B97F4A7C55)
-#define MAX_LINKED_LIST 4 
+#define TT_BUCKET_SIZE 4 // entries per bucket
+#define TT_DEFAULT_MB 4 // 65536 buckets
+#define TT_HUGE_PAGE_SIZE (UINT64_C(2) << 20) // tables of at least this size are mapped on huge pages
+#define TT_MOVE_MASK ((UINT64_C(1) << 44) - 1) // the fields of a move code that identify the move, see encrypt_move
+#define TT_FILE_MAGIC 0x54544243 // "CBTT"
+#define TT_FILE_VERSION 1 // of the entry format, raise it whenever TTEntry or the move code changes
 
-typedef struct Node {
-    uint8_t search_info;
-    uint64_t move_code;
-    struct Node* next;
-    uint64_t hash;
-} Node;
+// data is the move code << 8 | search info (depth | bound << 6), zero for an empty entry
+typedef struct TTEntry {
+    uint64_t key; // zobrist hash ^ data
+    uint64_t data;
+} TTEntry;
 
-extern Node** TransTable;
+#define TT_ENTRY_MOVE(entry) decrypt_move((entry)->data >> 8)
+#define TT_ENTRY_DEPTH(entry) ((int)((entry)->data & 0x3f))
+#define TT_ENTRY_BOUND(entry) ((int)(((entry)->data >> 6) & 3))
 
+// file layout of a saved table: the header, then the entries as they are in memory
+typedef struct TTFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t zobrist_seed; // PRIME of the saving engine
+    uint64_t zobrist_check; // first key drawn from the seed, catches a change to how the keys are generated
+    uint64_t buckets;
+    uint32_t bucket_size;
+    uint32_t entry_size;
+} TTFileHeader;
+
+// one engine's table, owned by its Engine (see search.h)
+typedef struct TransTable {
+    TTEntry* entries; // (mask + 1) * TT_BUCKET_SIZE
+    uint64_t mask; // buckets - 1
+    size_t size; // bytes
+    bool mapped; // entries are mmap'd rather than from the heap
+    bool shared; // mapped from a POSIX shared memory segment
+    bool read_only; // add_item does nothing
+} TransTable;
+
+// where an engine's table lives, from the command line
+typedef struct TableOptions {
+    int hash_mb;
+    const char* shared_name; // POSIX shared memory segment, NULL for a private table
+    bool read_only; // of a shared table
+} TableOptions;
+
+void initialize_zobrist();
+uint64_t zobrist_signature();
 uint64_t get_hash(uint64_t* board);
-void initilize_trans_table();
-void free_trans_table();
-void add_item(Move* in_m, int type, int depth, uint64_t* board);
+bool initilize_trans_table(TransTable* tt, int hash_mb);
+bool attach_shared_trans_table(TransTable* tt, const char* name, int hash_mb, bool read_only);
+bool open_trans_table(TransTable* tt, const TableOptions* options);
+void clear_trans_table(TransTable* tt);
+void free_trans_table(TransTable* tt);
+int hashfull(const TransTable* tt);
+bool save_trans_table(const TransTable* tt, const char* filename);
+bool load_trans_table(TransTable* tt, const char* filename);
+uint64_t move_hash_delta(const Move* m);
+void add_item(TransTable* tt, Move* in_m, int type, int depth, uint64_t hash);
+bool query_table(const TransTable* tt, uint64_t hash, TTEntry* out);
 Move decrypt_move(uint64_t code);
-uint64_t encrypt_move(Move* m);
\ No newline at end of file
+uint64_t encrypt_move(Move* m);
+
+// starts loading the bucket of a position into cache
+static inline void prefetch_bucket(const TransTable* tt, uint64_t hash){
+    if (tt->entries != NULL) __builtin_prefetch(tt->entries + (hash & tt->mask) * TT_BUCKET_SIZE);
+}
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 
 // helper functions, many are used to print different data structures, convert encodings from one to another, freeing heap allocated memory, and various other micro-tasks
 
@@ -145,18 +146,57 @@ void print_principal_variation(searchResult* sr, uint64_t* board){
 
 // APPLY, CREATE, AND COPY MOVE STRUCT FUNCTIONS
 
+/**
+ * Computes the parts of the board derived from the piece bitboards (the occupancy of each side and the material key).
+ * @param board The board state.
+ */
+void prep_board(uint64_t* board){
+    board[WHITE_PCS] = board[WHITE_PAWN] |
+    board[WHITE_KNIGHT] |
+    board[WHITE_BISHOP] |
+    board[WHITE_ROOK] |
+    board[WHITE_QUEEN] |
+    board[WHITE_KING]; 
+    
+    board[BLACK_PCS] = board[BLACK_PAWN] |
+    board[BLACK_KNIGHT] |
+    board[BLACK_BISHOP] |
+    board[BLACK_ROOK] |
+    board[BLACK_QUEEN] |
+    board[BLACK_KING]; 
+
+    board[MATERIAL] = 0;
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+        board[MATERIAL] |= (uint64_t)min(__builtin_popcountll(board[pc]), 15) << (pc << 2);
+    }
+}
+
 /**
  * Applies a move to the board.
  * @param m The move to be applied.
  * @param board The board state.
  */
 void apply_move(Move* m, uint64_t* board){
-    
-    board[m->pc1] ^= m->mov1;
+    // promotions toggle the pawn on its starting square only, the promotion square belongs to the promoted piece
+    uint64_t promotion_sq = m->type == PROMOTE ? m->mov2 : m->type == CAPTURE_PROMOTE ? m->mov3 : 0;
+
+    board[m->pc1] ^= m->mov1 ^ promotion_sq;
     board[m->pc2] ^= m->mov2;
     board[m->pc3] ^= m->mov3;
     
     board[INFO] ^= m->info;
+
+    // captured and promoted pieces change the material key, +1 if the toggle put the piece back on the board and -1 if it took it off.
+    // castling is stored as a capture of the rook's two squares, so only single square toggles count
+    if (m->type != EMPTY && (m->mov2 & (m->mov2 - 1)) == 0){
+        board[MATERIAL] += (board[m->pc2] & m->mov2) ? (UINT64_C(1) << (m->pc2 << 2)) : -(UINT64_C(1) << (m->pc2 << 2));
+    }
+    if (m->type == CAPTURE_PROMOTE){
+        board[MATERIAL] += (board[m->pc3] & m->mov3) ? (UINT64_C(1) << (m->pc3 << 2)) : -(UINT64_C(1) << (m->pc3 << 2));
+    }
+    if (promotion_sq){
+        board[MATERIAL] += (board[m->pc1] & m->mov1) ? (UINT64_C(1) << (m->pc1 << 2)) : -(UINT64_C(1) << (m->pc1 << 2));
+    }
     
     board[WHITE_PCS] = board[WHITE_PAWN] |
     board[WHITE_KNIGHT] |
@@ -392,9 +432,65 @@ uint64_t* from_FEN(const char* p){
         char rank = *p;
         board[INFO] |= sq_from_name(file,rank);
     }
+    prep_board(board);
     return board;
 }
 
+/**
+ * Writes the FEN of a position. The engine does not keep the halfmove clock, it is written as 0.
+ * @param board The board state.
+ * @param ply The ply of the game, for the fullmove number.
+ * @param out The FEN, truncated to size.
+ */
+void to_FEN(const uint64_t* board, int ply, char* out, size_t size){
+    char squares[64] = {0};
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+        for (uint64_t pieces = board[pc]; pieces; pieces &= pieces - 1){
+            squares[__builtin_ctzll(pieces)] = PIECE_CODES[pc];
+        }
+    }
+    char fen[96];
+    int n = 0;
+    for (int rank = 7; rank >= 0; rank--){
+        int empty = 0;
+        for (int sq = rank * 8 + 7; sq >= rank * 8; sq--){
+            if (!squares[sq]){
+                empty++;
+                continue;
+            }
+            if (empty) fen[n++] = '0' + empty;
+            empty = 0;
+            fen[n++] = squares[sq];
+        }
+        if (empty) fen[n++] = '0' + empty;
+        if (rank) fen[n++] = '/';
+    }
+    fen[n++] = ' ';
+    fen[n++] = board[INFO] & TURN_BIT ? 'w' : 'b';
+    fen[n++] = ' ';
+    int rights = n;
+    if (board[INFO] & WHITE_KINGSIDE_RIGHT) fen[n++] = 'K';
+    if (board[INFO] & WHITE_QUEENSIDE_RIGHT) fen[n++] = 'Q';
+    if (board[INFO] & BLACK_KINGSIDE_RIGHT) fen[n++] = 'k';
+    if (board[INFO] & BLACK_QUEENSIDE_RIGHT) fen[n++] = 'q';
+    if (n == rights) fen[n++] = '-';
+    fen[n] = 0;
+    uint64_t ep = board[INFO] & (RANK_3 | RANK_6);
+    snprintf(out, size, "%s %s 0 %d", fen, ep ? SQUARES[__builtin_ctzll(ep)] : "-", ply / 2 + 1);
+}
+
+/**
+ * Counts the plies played before a FEN position, from its side to move and fullmove number.
+ * @param p The FEN string.
+ * @return The ply of the game, 0 in the starting position.
+ */
+int ply_from_FEN(const char* p){
+    char side = 'w';
+    int fullmove = 1;
+    sscanf(p, "%*s %c %*s %*s %*d %d", &side, &fullmove);
+    return 2 * max(fullmove - 1, 0) + (side == 'b');
+}
+
 /**
  * Converts a move to UCI format.
  * @param mov The move to be converted.
@@ -402,7 +498,7 @@ uint64_t* from_FEN(const char* p){
  * @return The UCI string representing the move.
  */
 char* move_to_uci(Move* mov, uint64_t* board){
-    char *out = malloc(5);
+    char *out = malloc(6);
     uint64_t starting_sq = mov->mov1 & board[mov->pc1];
     uint64_t ending_sq = mov->mov1 & ~board[mov->pc1];
     sprintf(out,"%s%s ",SQUARES[__builtin_ctzll(starting_sq)],SQUARES[__builtin_ctzll(ending_sq)]);
@@ -444,6 +540,42 @@ char* move_to_uci(Move* mov, uint64_t* board){
     board[BLACK_KING];
 }
 
+/**
+ * Writes a move the way the UCI protocol spells it, without the padding of move_to_uci and with a lowercase promotion piece.
+ * @param mov The move to be written.
+ * @param board The board state.
+ * @param out The move, such as "e2e4" or "a7a8q", truncated to size.
+ */
+void format_uci_move(Move* mov, uint64_t* board, char* out, size_t size){
+    char* name = move_to_uci(mov, board);
+    snprintf(out, size, "%s", name[0] == ' ' ? name + 1 : name);
+    for (char* c = out; *c; c++) *c = tolower((unsigned char)*c);
+    free(name);
+}
+
+/**
+ * Finds the legal move written in UCI format, such as "e2e4" or "e7e8q".
+ * @param uci The move in UCI format.
+ * @param board The board state, unchanged on return.
+ * @param out Set to the matching move.
+ * @return True if the move is legal in the position.
+ */
+bool move_from_uci(const char* uci, uint64_t* board, Move* out){
+    Move movs[MOVES_ARRAY_LENGTH];
+    get_legal_moves(movs, board);
+    for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+        char* name = move_to_uci(movptr, board);
+        const char* trimmed = name[0] == ' ' ? name + 1 : name;
+        bool match = strncmp(trimmed, uci, 4) == 0 && tolower((unsigned char)trimmed[4]) == tolower((unsigned char)uci[4]);
+        free(name);
+        if (match){
+            *out = *movptr;
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  * Converts a square name (e.g., "e4") to its bitboard representation.
  * @param square_name The name of the square.
@@ -2,6 +2,7 @@
 #include "constants.h"
 #include "get_moves.h"
 #include "search.h"
+#include <stddef.h>
 
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 #define min(a,b) (((a) < (b)) ? (a) : (b))
@@ -20,6 +21,10 @@ Move *create_move3 (Move *m, int pc1, uint64_t mov1, int pc2, uint64_t mov2, int
 void prep_board (uint64_t *board);
 Move copy_move (const Move *original);
 uint64_t *from_FEN (const char *p);
+int ply_from_FEN (const char *p);
+void to_FEN (const uint64_t *board, int ply, char *out, size_t size);
 char *move_to_uci (Move *mov, uint64_t *board);
+void format_uci_move (Move *mov, uint64_t *board, char *out, size_t size);
+bool move_from_uci (const char *uci, uint64_t *board, Move *out);
 void print_principal_variation (searchResult *sr, uint64_t *board);
 void read_pos_csv(const char* filename, char** FENs, int num_rows);
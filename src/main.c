@@ -14,37 +14,103 @@
 #include "search.h"
 #include "helpers.h"
 #include "hash_table.h"
+#include "eval.h"
+#include "testing.h"
+#include "tune.h"
+#include "endgame.h"
+#include "tbprobe.h"
+#include "bitbase.h"
+#include "uci.h"
+#include "time_manager.h"
+#include "perft.h"
+#include "server.h"
+#include "analysis_cache.h"
+#include "book.h"
+#include "book_builder.h"
+#include "pgn.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <limits.h>
 #include <time.h>
+#include <unistd.h>
 
-# define SEARCH_TIME 500 // 500 ms per move
+# define SEARCH_TIME 500 // ms per move
+# define EVAL_BENCH_POSITIONS 100000
+# define EVAL_BENCH_REPS 20
 
 // main.c acts as a interface between the controller (written in Python) and the engine itself, mostly boilerplate stuff here
 
+static Engine* engine; // searches every move of the session
+
 char* get_bot_move(char* FEN){
-    clock_t start = clock();
     printf("%s\n",FEN);
     uint64_t* board = from_FEN(FEN);
-    searchResult* bot_move;
+    searchResult* bot_move = NULL;
+
+    // known theory is played from the book
+    Move book_move;
+    if (probe_book(board, ply_from_FEN(FEN), &book_move)){
+        printf("Book move\n");
+        char* move = move_to_uci(&book_move, board);
+        free_board(board);
+        return move;
+    }
+
+    // in the tablebases the DTZ tables give the move directly
+    Move tb_move;
+    int wdl;
+    if (tb_probe_root(board, &tb_move, &wdl)){
+        printf("Tablebase: %d\n", wdl);
+        char* move = move_to_uci(&tb_move, board);
+        free_board(board);
+        return move;
+    }
+
+    // a deep enough search of an earlier run is the answer
+    int depth = 0;
+    bot_move = consult_analysis_cache(board, AnalysisCacheDepth, &engine->tt, &depth);
+    bool cached = bot_move != NULL;
+    if (cached){
+        printf("Analysis cache: depth %d\n", depth);
+    }
 
-    // iterative deepening
-    int i = 1;
-    printf("Depth: ");
-    while((double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC < SEARCH_TIME){
-        printf("%d, ",i);
-        bot_move = search(board,i,INT16_MIN,INT16_MAX);
-        i++;
+    // iterative deepening, an iteration cut off by the time limit is thrown away
+    TimeManager tm;
+    init_time_manager(&tm, &(TimeLimits){-1, 0, 0, SEARCH_TIME}, 0);
+    engine->stop = false;
+    start_search_clock(engine, tm.hard, NULL);
+    Move legal[MOVES_ARRAY_LENGTH];
+    int num_legal = get_legal_moves(legal, board);
+    bool forced = num_legal == 1;
+    for (int i = 1; !cached && i <= MAX_SEARCH_DEPTH; i++){
+        set_search_depth(engine, i);
+        searchResult* result = search(engine,board,i,INT16_MIN,INT16_MAX);
+        if (engine->stop && bot_move != NULL){
+            free_search_result(result);
+            break;
+        }
+        free_search_result(bot_move);
+        bot_move = result;
+        depth = i;
+        // print information in the same format as the UCI info lines
+        long elapsed = search_elapsed(engine);
+        print_search_info(engine, bot_move, board, i, elapsed);
+        if (forced || !time_for_next_iteration(&tm, bot_move, elapsed)) break;
+    }
+    // a first iteration cut off before it searched any root move has none, answer with a legal move instead
+    if (bot_move->best_move.type == BOOK_END && num_legal > 0){
+        bot_move->best_move = legal[0];
+    }
+    if (!cached){
+        record_analysis(board, bot_move, depth);
     }
     
-    // print information, return best move to controller
-    printf("Eval: %d\n",bot_move->best_eval);
-    print_principal_variation(bot_move,board);
+    // return best move to controller
     char* move = move_to_uci(&(bot_move->best_move),board);
     free_search_result(bot_move);
+    free_board(board);
     return move;
 }
 
@@ -53,7 +119,7 @@ char* debug_get_bot_move(int depth,char* FEN){
     uint64_t* board = from_FEN(FEN);
     uint64_t* copy = from_FEN(FEN);
 
-    searchResult* bot_move = search(board,depth,INT16_MIN,INT16_MAX);
+    searchResult* bot_move = search(engine,board,depth,INT16_MIN,INT16_MAX);
     for (int pc = WHITE_PAWN; pc <= INFO; pc++){
         if (copy[pc] != board[pc]){
             printf("%d DIFFERENT\n",pc);
@@ -98,6 +164,11 @@ void receiver() {
                 fprintf(stderr,"%s\n",move);
                 fflush(stderr);
             } 
+            // compare scalar and batched evaluation throughput, optionally over a csv of positions
+            else if (strncmp(message, "EVALBENCH", 9) == 0) {
+                eval_batch_benchmark(message[9] == ' ' ? message + 10 : NULL, EVAL_BENCH_POSITIONS, EVAL_BENCH_REPS);
+                fflush(stdout);
+            }
             else {
                 fprintf(stderr,"Unknown Message\n");
                 fflush(stderr);
@@ -106,12 +177,245 @@ void receiver() {
         else if (strcmp(buffer, "EXIT") == 0) {
             break;
         }
+        // switch to the UCI protocol for the rest of the session
+        else if (strcmp(buffer, "uci") == 0) {
+            uci_loop(engine);
+            break;
+        }
+    }
+}
+
+// transposition table options: --hash <mb> --shared-hash <segment name> --shared-hash-mode <rw|ro>, returns false for other options
+static bool parse_table_option(const char* option, const char* value, TableOptions* table){
+    if (strcmp(option, "--hash") == 0){
+        table->hash_mb = max(atoi(value), 1);
+    } else if (strcmp(option, "--shared-hash") == 0){
+        table->shared_name = value;
+    } else if (strcmp(option, "--shared-hash-mode") == 0){
+        table->read_only = strcmp(value, "ro") == 0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// analysis cache options: --analysis-cache <file> --analysis-cache-depth <depth>, returns false for other options
+static bool parse_cache_option(const char* option, const char* value, const char** cache_file){
+    if (strcmp(option, "--analysis-cache") == 0){
+        *cache_file = value;
+    } else if (strcmp(option, "--analysis-cache-depth") == 0){
+        AnalysisCacheDepth = min(max(atoi(value), 1), MAX_SEARCH_DEPTH);
+    } else {
+        return false;
     }
+    return true;
 }
 
-int main() {
+// opening book options: --book <file> --book-max-ply <plies> --book-selection <best|weighted>, returns false for other options
+static bool parse_book_option(const char* option, const char* value, const char** book_file){
+    if (strcmp(option, "--book") == 0){
+        *book_file = value;
+    } else if (strcmp(option, "--book-max-ply") == 0){
+        BookMaxPly = atoi(value);
+    } else if (strcmp(option, "--book-selection") == 0){
+        BookSelection = strcmp(value, "best") == 0 ? BOOK_BEST : BOOK_WEIGHTED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    TableOptions table = {TT_DEFAULT_MB, NULL, false};
+    const char* hash_file = NULL; // loaded at startup when it exists and saved at exit, for warm restarts
+    const char* cache_file = NULL;
+    const char* book_file = NULL;
+    init_eval_tables();
+    init_material_table();
+    initialize_zobrist();
+
+    // tuning mode: chess_bot tune <positions csv> <params out> [epochs] [threads]
+    if (argc >= 4 && strcmp(argv[1], "tune") == 0){
+        int epochs = argc >= 5 ? atoi(argv[4]) : TUNE_DEFAULT_EPOCHS;
+        tune(argv[2], argv[3], epochs > 0 ? epochs : TUNE_DEFAULT_EPOCHS, argc >= 6 ? atoi(argv[5]) : 0);
+        return 0;
+    }
+    // search benchmark: chess_bot bench [depth] [fen] [--json] [--perf], before bitbases are loaded so the node count stays comparable
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0){
+        int depth = BENCH_DEFAULT_DEPTH;
+        const char* fen = NULL;
+        bool json = false, perf = false;
+        for (int i = 2; i < argc; i++){
+            if (strcmp(argv[i], "--json") == 0){
+                json = true;
+            } else if (strcmp(argv[i], "--perf") == 0){
+                perf = true;
+            } else if (i == 2 && atoi(argv[i]) > 0){
+                depth = min(atoi(argv[i]), MAX_SEARCH_DEPTH);
+            } else {
+                fen = argv[i];
+            }
+        }
+        search_bench(depth, fen, json, perf);
+        return 0;
+    }
+    // known answer checks: chess_bot check, exits with 1 if any fail
+    if (argc >= 2 && strcmp(argv[1], "check") == 0){
+        return run_checks() == 0 ? 0 : 1;
+    }
+    // kernel timings: chess_bot microbench [positions csv]
+    if (argc >= 2 && strcmp(argv[1], "microbench") == 0){
+        micro_benchmark(argc >= 3 ? argv[2] : NULL);
+        return 0;
+    }
+    // move generation check: chess_bot perft <depth> [fen] [--divide] [--threads <n>] [--hash <mb>]
+    if (argc >= 3 && strcmp(argv[1], "perft") == 0){
+        const char* fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+        bool divide = false;
+        int threads = 0, hash_mb = PERFT_DEFAULT_HASH_MB;
+        for (int i = 3; i < argc; i++){
+            if (strcmp(argv[i], "--divide") == 0){
+                divide = true;
+            } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+                threads = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc){
+                hash_mb = atoi(argv[++i]);
+            } else {
+                fen = argv[i];
+            }
+        }
+        run_perft(fen, atoi(argv[2]), divide, threads, hash_mb);
+        return 0;
+    }
+    // bitbase generation: chess_bot bitbase <file> [signatures...], KQK KRK KPK by default
+    if (argc >= 3 && strcmp(argv[1], "bitbase") == 0){
+        static const char* DEFAULT_SIGNATURES[] = {"KQK", "KRK", "KPK"};
+        bool ok = argc > 3 ? generate_bitbases(argv[2], (const char**)argv + 3, argc - 3, 0) : generate_bitbases(argv[2], DEFAULT_SIGNATURES, 3, 0);
+        return ok ? 0 : 1;
+    }
+    // opening book from games: chess_bot book <book out> <pgn files...> [--threads <n>] [--max-ply <plies>] [--min-games <games>] [--memory <mb>]
+    if (argc >= 4 && strcmp(argv[1], "book") == 0){
+        BookBuildOptions options = {0, BOOK_DEFAULT_MAX_PLY, BUILDER_DEFAULT_MIN_GAMES, BUILDER_DEFAULT_MB};
+        const char** files = malloc(argc * sizeof(char*));
+        int num_files = 0;
+        for (int i = 3; i < argc; i++){
+            if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+                options.threads = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--max-ply") == 0 && i + 1 < argc){
+                options.max_ply = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--min-games") == 0 && i + 1 < argc){
+                options.min_games = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc){
+                options.memory_mb = atoi(argv[++i]);
+            } else {
+                files[num_files++] = argv[i];
+            }
+        }
+        long written = build_book(argv[2], files, num_files, &options);
+        free(files);
+        return written < 0 ? 1 : 0;
+    }
+    // labelled positions from games: chess_bot pgn-extract <records out> <pgn files...> [--threads <n>] [--min-ply <ply>] [--max-ply <ply>]
+    if (argc >= 4 && strcmp(argv[1], "pgn-extract") == 0){
+        int threads = 0, min_ply = 0, max_ply = INT_MAX;
+        const char** files = malloc(argc * sizeof(char*));
+        int num_files = 0;
+        for (int i = 3; i < argc; i++){
+            if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+                threads = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--min-ply") == 0 && i + 1 < argc){
+                min_ply = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--max-ply") == 0 && i + 1 < argc){
+                max_ply = atoi(argv[++i]);
+            } else {
+                files[num_files++] = argv[i];
+            }
+        }
+        long written = extract_pgn_records(argv[2], files, num_files, threads, min_ply, max_ply);
+        free(files);
+        return written < 0 ? 1 : 0;
+    }
+    // analysis cache compaction: chess_bot compact-cache <cache file> <output file>
+    if (argc >= 4 && strcmp(argv[1], "compact-cache") == 0){
+        return compact_analysis_cache(argv[2], argv[3]) < 0 ? 1 : 0;
+    }
+    if (load_bitbases(BITBASE_DEFAULT_FILE) < 0){
+        return 1;
+    }
+    // game server: chess_bot server <socket path> [--workers <n>] [--max-movetime <ms>] [--syzygy-path <dir>] [book options] [cache options] [table options]
+    if (argc >= 3 && strcmp(argv[1], "server") == 0){
+        int workers = 0;
+        long max_movetime = 0;
+        for (int i = 3; i + 1 < argc; i += 2){
+            if (strcmp(argv[i], "--workers") == 0){
+                workers = atoi(argv[i + 1]);
+            } else if (strcmp(argv[i], "--max-movetime") == 0){
+                max_movetime = atol(argv[i + 1]);
+            } else if (strcmp(argv[i], "--syzygy-path") == 0){
+                printf("Found %d tablebases\n", tb_init(argv[i + 1]));
+            } else if (!parse_cache_option(argv[i], argv[i + 1], &cache_file) && !parse_book_option(argv[i], argv[i + 1], &book_file) && !parse_table_option(argv[i], argv[i + 1], &table)){
+                printf("Unknown option %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if ((cache_file != NULL && !open_analysis_cache(cache_file)) || (book_file != NULL && !open_book(book_file))){
+            return 1;
+        }
+        int status = run_server(argv[2], workers, max_movetime, &table);
+        close_book();
+        close_analysis_cache();
+        tb_free();
+        free_bitbases();
+        return status;
+    }
+    // engine options: chess_bot [--params <params file>] [--bitbases <file>] [--syzygy-path <dir>] [--syzygy-probe-limit <pieces>] [--syzygy-probe-depth <depth>]
+    //                          [--hash <mb>] [--shared-hash <segment name>] [--shared-hash-mode <rw|ro>] [--hash-file <file>]
+    //                          [--analysis-cache <file>] [--analysis-cache-depth <depth>]
+    //                          [--book <file>] [--book-max-ply <plies>] [--book-selection <best|weighted>]
+    for (int i = 1; i + 1 < argc; i += 2){
+        if (strcmp(argv[i], "--params") == 0){
+            if (!load_eval_params(argv[i + 1])){
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bitbases") == 0){
+            if (load_bitbases(argv[i + 1]) <= 0){
+                printf("No bitbases loaded from %s\n", argv[i + 1]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--syzygy-path") == 0){
+            printf("Found %d tablebases\n", tb_init(argv[i + 1]));
+        } else if (strcmp(argv[i], "--syzygy-probe-limit") == 0){
+            SyzygyProbeLimit = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--syzygy-probe-depth") == 0){
+            SyzygyProbeDepth = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--hash-file") == 0){
+            hash_file = argv[i + 1];
+        } else if (!parse_cache_option(argv[i], argv[i + 1], &cache_file) && !parse_book_option(argv[i], argv[i + 1], &book_file) && !parse_table_option(argv[i], argv[i + 1], &table)){
+            printf("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    engine = create_engine();
+    if (engine == NULL || !open_trans_table(&engine->tt, &table)){
+        printf("Error allocating engine\n");
+        return 1;
+    }
+    if (hash_file != NULL && access(hash_file, R_OK) == 0 && load_trans_table(&engine->tt, hash_file)){
+        printf("Loaded transposition table from %s\n", hash_file);
+    }
+    if ((cache_file != NULL && !open_analysis_cache(cache_file)) || (book_file != NULL && !open_book(book_file))){
+        return 1;
+    }
     // get_bot_move("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
     receiver();
+    if (hash_file != NULL && !engine->tt.read_only){
+        save_trans_table(&engine->tt, hash_file);
+    }
+    close_book();
+    close_analysis_cache();
+    tb_free();
+    free_bitbases();
+    free_engine(engine);
     // return 0;
 }
 
@@ -0,0 +1,112 @@
+#include "perf_counters.h"
+#include <string.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// HARDWARE COUNTERS
+// counts instructions, cycles, cache and branch misses of this process with perf_event_open. each event is opened on its own rather
+// than as a group, so machines (or sandboxes and virtual machines) that count only some of them still report those. where
+// perf_event_paranoid or a seccomp filter forbids the call entirely, nothing is counted and the report says so
+
+static const char* PERF_EVENT_NAMES[NUM_PERF_EVENTS] = {"instructions", "cycles", "l1d_misses", "llc_misses", "branch_misses"};
+
+#ifdef __linux__
+static int open_event(uint32_t type, uint64_t config){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1; // threads started after perf_start are counted too
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/**
+ * Opens and starts the counters.
+ * @param pc The counters, events that cannot be counted are left closed.
+ * @return false if no event could be counted.
+ */
+bool perf_start(PerfCounters* pc){
+    bool any = false;
+    memset(pc->values, 0, sizeof(pc->values));
+    memset(pc->counted, 0, sizeof(pc->counted));
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) pc->fds[e] = -1;
+#ifdef __linux__
+    pc->fds[PERF_INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    pc->fds[PERF_CYCLES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    pc->fds[PERF_L1D_MISSES] = open_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    pc->fds[PERF_LLC_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    pc->fds[PERF_BRANCH_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    for (int e = 0; e < NUM_PERF_EVENTS; e++){
+        if (pc->fds[e] < 0) continue;
+        any = pc->counted[e] = true;
+        ioctl(pc->fds[e], PERF_EVENT_IOC_RESET, 0);
+        ioctl(pc->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    return any;
+}
+
+/**
+ * Stops the counters, reads them and closes them.
+ * @param pc The counters started by perf_start.
+ */
+void perf_stop(PerfCounters* pc){
+#ifdef __linux__
+    for (int e = 0; e < NUM_PERF_EVENTS; e++){
+        if (pc->fds[e] < 0) continue;
+        ioctl(pc->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(pc->fds[e], &pc->values[e], sizeof(uint64_t)) != sizeof(uint64_t)){
+            pc->values[e] = 0;
+        }
+        close(pc->fds[e]);
+        pc->fds[e] = -1;
+    }
+#endif
+}
+
+/**
+ * Prints each counted event in total and per node, with instructions per cycle when both were counted.
+ * @param pc The counters, after perf_stop.
+ * @param nodes The number of nodes searched while counting.
+ * @param json Prints a "perf" JSON member instead of a table, with null for events that were not counted.
+ * @param out Where to print.
+ */
+void perf_report(const PerfCounters* pc, uint64_t nodes, bool json, FILE* out){
+    bool any = false;
+    for (int e = 0; e < NUM_PERF_EVENTS; e++) any |= pc->counted[e];
+    if (json){
+        fprintf(out, "\"perf\": {");
+        for (int e = 0; e < NUM_PERF_EVENTS; e++){
+            if (pc->counted[e]){
+                fprintf(out, "%s\"%s\": %llu, \"%s_per_node\": %.2f", e ? ", " : "", PERF_EVENT_NAMES[e], (unsigned long long)pc->values[e], PERF_EVENT_NAMES[e], nodes ? (double)pc->values[e] / nodes : 0.0);
+            } else {
+                fprintf(out, "%s\"%s\": null, \"%s_per_node\": null", e ? ", " : "", PERF_EVENT_NAMES[e], PERF_EVENT_NAMES[e]);
+            }
+        }
+        fprintf(out, "}");
+        return;
+    }
+    if (!any){
+        fprintf(out, "Hardware counters unavailable (no perf_event_open access)\n");
+        return;
+    }
+    for (int e = 0; e < NUM_PERF_EVENTS; e++){
+        if (pc->counted[e]){
+            fprintf(out, "%-16s: %llu (%.2f per node)\n", PERF_EVENT_NAMES[e], (unsigned long long)pc->values[e], nodes ? (double)pc->values[e] / nodes : 0.0);
+        } else {
+            fprintf(out, "%-16s: n/a\n", PERF_EVENT_NAMES[e]);
+        }
+    }
+    if (pc->counted[PERF_INSTRUCTIONS] && pc->counted[PERF_CYCLES] && pc->values[PERF_CYCLES]){
+        fprintf(out, "%-16s: %.2f\n", "ipc", (double)pc->values[PERF_INSTRUCTIONS] / pc->values[PERF_CYCLES]);
+    }
+}
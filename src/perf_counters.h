@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// hardware events counted around a bench run or search
+enum PERF_EVENT {
+    PERF_INSTRUCTIONS,
+    PERF_CYCLES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_EVENTS
+};
+
+typedef struct PerfCounters {
+    int fds[NUM_PERF_EVENTS]; // -1 when closed
+    bool counted[NUM_PERF_EVENTS]; // false for events the kernel would not count
+    uint64_t values[NUM_PERF_EVENTS];
+} PerfCounters;
+
+bool perf_start(PerfCounters* pc);
+void perf_stop(PerfCounters* pc);
+void perf_report(const PerfCounters* pc, uint64_t nodes, bool json, FILE* out);
@@ -0,0 +1,174 @@
+#include "perft.h"
+#include "constants.h"
+#include "get_moves.h"
+#include "hash_table.h"
+#include "helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// PERFT
+// counts the leaf nodes of the legal move tree to a fixed depth, to check move generation against known counts and to time it.
+// the last ply is bulk counted (legal moves are counted, not made), subtree counts can be cached by zobrist hash and depth, and the
+// root moves are shared out between threads
+
+// entries are written without locks: the key is stored xor'd with the data, so an entry torn by two threads writing at once fails
+// the key check instead of returning a wrong count
+typedef struct PerftEntry {
+    uint64_t key; // zobrist hash ^ data
+    uint64_t data; // count << 8 | depth
+} PerftEntry;
+
+static PerftEntry* perft_table = NULL;
+static uint64_t perft_mask = 0;
+
+static void init_perft_table(int hash_mb){
+    uint64_t entries = 1;
+    while (entries * 2 * sizeof(PerftEntry) <= (uint64_t)hash_mb << 20) entries *= 2;
+    perft_table = calloc(entries, sizeof(PerftEntry));
+    perft_mask = perft_table != NULL ? entries - 1 : 0;
+}
+
+static uint64_t perft_node(uint64_t* board, int depth, bool hashed){
+    Move movs[MOVES_ARRAY_LENGTH];
+    if (depth == 1){
+        return get_legal_moves(movs, board);
+    }
+
+    uint64_t hash = 0;
+    PerftEntry* entry = NULL;
+    if (hashed){
+        hash = get_hash(board);
+        entry = &perft_table[(hash ^ (uint64_t)depth * PRIME) & perft_mask];
+        uint64_t data = entry->data;
+        if ((entry->key ^ data) == hash && (data & 0xff) == (uint64_t)depth){
+            return data >> 8;
+        }
+    }
+
+    uint64_t count = 0;
+    get_legal_moves(movs, board);
+    for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+        apply_move(movptr, board);
+        count += perft_node(board, depth - 1, hashed);
+        apply_move(movptr, board);
+    }
+
+    if (hashed){
+        uint64_t data = count << 8 | depth;
+        entry->data = data;
+        entry->key = hash ^ data;
+    }
+    return count;
+}
+
+/**
+ * Counts the leaf nodes of the legal move tree, without the perft table.
+ * @param board The board state, left unchanged.
+ * @param depth The depth of the tree in plies.
+ * @return The number of leaf nodes.
+ */
+uint64_t perft(uint64_t* board, int depth){
+    if (depth <= 0) return 1;
+    return perft_node(board, depth, false);
+}
+
+// ROOT SPLITTING
+
+typedef struct PerftWorker {
+    pthread_t thread;
+    uint64_t board[BOARD_ARRAY_SIZE];
+    Move* root_moves;
+    uint64_t* counts;
+    int num_moves;
+    int depth;
+} PerftWorker;
+
+static int next_root_move;
+static pthread_mutex_t root_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// takes root moves until none are left, so threads that draw small subtrees move on to the next one
+static void* perft_worker(void* arg){
+    PerftWorker* w = arg;
+    while (1){
+        pthread_mutex_lock(&root_lock);
+        int i = next_root_move++;
+        pthread_mutex_unlock(&root_lock);
+        if (i >= w->num_moves) break;
+
+        apply_move(&w->root_moves[i], w->board);
+        w->counts[i] = w->depth > 1 ? perft_node(w->board, w->depth - 1, perft_table != NULL) : 1;
+        apply_move(&w->root_moves[i], w->board);
+    }
+    return NULL;
+}
+
+/**
+ * Runs perft on a position and prints the node count, time, and speed.
+ * @param FEN The position.
+ * @param depth The depth of the tree in plies.
+ * @param divide Prints the count below each root move as well.
+ * @param num_threads The number of threads the root moves are split between, 0 for one per core.
+ * @param hash_mb Size of the perft table, 0 to count every subtree.
+ * @return The number of leaf nodes.
+ */
+uint64_t run_perft(const char* FEN, int depth, bool divide, int num_threads, int hash_mb){
+    uint64_t* board = from_FEN(FEN);
+    Move root_moves[MOVES_ARRAY_LENGTH];
+    int num_moves = get_legal_moves(root_moves, board);
+    uint64_t counts[MOVES_ARRAY_LENGTH];
+
+    if (num_threads <= 0){
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads > num_moves) num_threads = num_moves;
+    if (num_threads < 1) num_threads = 1;
+    if (hash_mb > 0 && depth > 2){
+        init_perft_table(hash_mb);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t total = depth <= 0 ? 1 : 0;
+    if (depth > 0){
+        next_root_move = 0;
+        PerftWorker* workers = malloc(num_threads * sizeof(PerftWorker));
+        for (int t = 0; t < num_threads; t++){
+            memcpy(workers[t].board, board, sizeof(workers[t].board));
+            workers[t].root_moves = root_moves;
+            workers[t].counts = counts;
+            workers[t].num_moves = num_moves;
+            workers[t].depth = depth;
+            pthread_create(&workers[t].thread, NULL, perft_worker, &workers[t]);
+        }
+        for (int t = 0; t < num_threads; t++){
+            pthread_join(workers[t].thread, NULL);
+        }
+        free(workers);
+        for (int i = 0; i < num_moves; i++){
+            total += counts[i];
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    if (divide){
+        for (int i = 0; i < num_moves; i++){
+            char name[8];
+            format_uci_move(&root_moves[i], board, name, sizeof(name));
+            printf("%s: %llu\n", name, (unsigned long long)counts[i]);
+        }
+        printf("\n");
+    }
+    printf("Depth %d: %llu nodes, %.0f ms, %.2f M nodes/s (%d threads%s)\n", depth, (unsigned long long)total, ms,
+        ms > 0 ? total / (ms * 1000.0) : 0.0, num_threads, perft_table != NULL ? ", hashed" : "");
+    fflush(stdout);
+
+    free(perft_table);
+    perft_table = NULL;
+    free_board(board);
+    return total;
+}
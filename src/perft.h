@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PERFT_DEFAULT_HASH_MB 64
+
+uint64_t perft(uint64_t* board, int depth);
+uint64_t run_perft(const char* FEN, int depth, bool divide, int num_threads, int hash_mb);
@@ -0,0 +1,490 @@
+#include "pgn.h"
+#include "constants.h"
+#include "helpers.h"
+#include "get_moves.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// PGN READER
+// reads games in the portable game notation without copying them: the file is memory mapped, a game is a slice of tag pair lines
+// followed by a slice of movetext, and only the FEN and result tags are looked at. movetext is replayed token by token, comments,
+// variations and annotation glyphs are skipped, and each move in standard algebraic notation (SAN) is resolved against the move
+// generator's output for the position, so the board follows the game exactly as the engine would play it.
+//
+// large collections are split by byte range: a cursor starts at the first game beginning in its range and reads every game that
+// starts before the range ends, so threads each given a range read every game of the file once. pages that a cursor has read past
+// are handed back to the kernel, so a file of many gigabytes is read with little memory.
+//
+// extract_pgn_records turns collections into "FEN,move,result" lines, the labelled positions the tuner reads (see load_tune_set)
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+#define KING 5 // piece types as the offset from the side's pawn
+
+/**
+ * Maps a PGN file for reading.
+ * @param pgn The file, empty if it cannot be opened.
+ * @param filename The PGN file.
+ * @return false if the file cannot be opened or mapped.
+ */
+bool open_pgn(PgnFile* pgn, const char* filename){
+    *pgn = (PgnFile){NULL, 0};
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0){
+        printf("Error opening file\n");
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0){
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0){
+        close(fd);
+        return true; // no games
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED){
+        printf("Error mapping file\n");
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    pgn->data = map;
+    pgn->size = st.st_size;
+    return true;
+}
+
+void close_pgn(PgnFile* pgn){
+    if (pgn->data != NULL) munmap((void*)pgn->data, pgn->size);
+    *pgn = (PgnFile){NULL, 0};
+}
+
+// start of the line after the one p is in
+static size_t next_line(const PgnFile* pgn, size_t p){
+    const char* newline = memchr(pgn->data + p, '\n', pgn->size - p);
+    return newline != NULL ? (size_t)(newline - pgn->data) + 1 : pgn->size;
+}
+
+// a line that opens with a tag pair, [Name "value"], rather than text in brackets such as a [%clk 0:01:00] command in a comment
+static bool is_tag_pair(const PgnFile* pgn, size_t p){
+    if (p + 1 >= pgn->size || pgn->data[p] != '[' || !isalpha((unsigned char)pgn->data[p + 1])) return false;
+    p++;
+    while (p < pgn->size && (isalnum((unsigned char)pgn->data[p]) || pgn->data[p] == '_')) p++;
+    while (p < pgn->size && pgn->data[p] == ' ') p++;
+    return p < pgn->size && pgn->data[p] == '"';
+}
+
+// start of the first tag pair line after the movetext that starts at p. a {comment} may span lines and hold lines that open with a
+// bracket, a ; comment runs to the end of its line
+static size_t movetext_end(const PgnFile* pgn, size_t p){
+    bool in_comment = false;
+    while (p < pgn->size && (in_comment || !is_tag_pair(pgn, p))){
+        size_t line_end = next_line(pgn, p);
+        for (size_t i = p; i < line_end; i++){
+            char c = pgn->data[i];
+            if (in_comment){
+                in_comment = c != '}';
+            } else if (c == '{'){
+                in_comment = true;
+            } else if (c == ';'){
+                break;
+            }
+        }
+        p = line_end;
+    }
+    return p;
+}
+
+// a game starts at a tag pair line whose previous line with text is movetext, or at the first tag pair of the file. a cursor starting
+// mid-file cannot know whether it is inside a comment, so only lines shaped like tag pairs count
+static bool game_starts_at(const PgnFile* pgn, size_t p){
+    if (!is_tag_pair(pgn, p)) return false;
+    size_t q = p;
+    while (q > 0 && isspace((unsigned char)pgn->data[q - 1])) q--;
+    if (q == 0) return true;
+    size_t line = q - 1;
+    while (line > 0 && pgn->data[line - 1] != '\n') line--;
+    return !is_tag_pair(pgn, line);
+}
+
+/**
+ * Creates a cursor over the games that start in a byte range of the file.
+ * @param pgn The file.
+ * @param start First byte of the range, the cursor moves on to the next game start.
+ * @param end End of the range, the game that starts before it is read to its end.
+ * @return The cursor, see next_pgn_game.
+ */
+PgnCursor pgn_range(const PgnFile* pgn, size_t start, size_t end){
+    size_t pos = min(start, pgn->size);
+    if (pos > 0 && pgn->data[pos - 1] != '\n') pos = next_line(pgn, pos);
+    while (pos > 0 && pos < pgn->size && !game_starts_at(pgn, pos)) pos = next_line(pgn, pos);
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (PgnCursor){pgn, pos, min(end, pgn->size), pos / page * page};
+}
+
+// value of a tag pair without the quotes, NULL if the game does not have the tag
+static const char* tag_value(const PgnGame* game, const char* name, size_t* length){
+    size_t name_length = strlen(name);
+    const char* end = game->tags + game->tags_length;
+    for (const char* line = game->tags; line < end; ){
+        const char* line_end = memchr(line, '\n', end - line);
+        if (line_end == NULL) line_end = end;
+        if ((size_t)(line_end - line) > name_length + 2 && line[0] == '[' && strncmp(line + 1, name, name_length) == 0 && line[name_length + 1] == ' '){
+            const char* open = memchr(line, '"', line_end - line);
+            const char* close = open != NULL ? memchr(open + 1, '"', line_end - open - 1) : NULL;
+            if (close == NULL) return NULL;
+            *length = close - open - 1;
+            return open + 1;
+        }
+        line = line_end + 1;
+    }
+    return NULL;
+}
+
+static int parse_result(const char* p, size_t length){
+    if (length >= 7 && strncmp(p, "1/2-1/2", 7) == 0) return PGN_DRAW;
+    if (length >= 3 && strncmp(p, "1-0", 3) == 0) return PGN_WHITE_WIN;
+    if (length >= 3 && strncmp(p, "0-1", 3) == 0) return PGN_BLACK_WIN;
+    return PGN_NO_RESULT;
+}
+
+// gives back the pages of the file that the cursor has read past
+static void release_pages(PgnCursor* cursor){
+    if (cursor->pos - cursor->released < PGN_RELEASE_CHUNK) return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t upto = cursor->pos / page * page;
+    madvise((void*)(cursor->file->data + cursor->released), upto - cursor->released, MADV_DONTNEED);
+    cursor->released = upto;
+}
+
+/**
+ * Reads the next game of the cursor's range.
+ * @param cursor The cursor, see pgn_range.
+ * @param game The game, pointing into the mapped file.
+ * @return false when no more games start in the range.
+ */
+bool next_pgn_game(PgnCursor* cursor, PgnGame* game){
+    const PgnFile* pgn = cursor->file;
+    size_t p = cursor->pos;
+    while (p < pgn->size && isspace((unsigned char)pgn->data[p])) p++;
+    if (p >= cursor->end) return false;
+
+    // tag pairs, one per line, then the movetext up to the tags of the next game
+    size_t tags = p;
+    while (p < pgn->size && pgn->data[p] == '[') p = next_line(pgn, p);
+    size_t moves = p;
+    p = movetext_end(pgn, p);
+    game->tags = pgn->data + tags;
+    game->tags_length = moves - tags;
+    game->moves = pgn->data + moves;
+    game->moves_length = p - moves;
+    cursor->pos = p;
+    release_pages(cursor);
+
+    size_t length;
+    const char* fen = tag_value(game, "FEN", &length);
+    if (fen != NULL){
+        // from_FEN needs the board, side to move, castling and en passant fields
+        int fields = 1;
+        for (size_t i = 0; i < length; i++) fields += fen[i] == ' ';
+        length = fields >= 4 && length < PGN_MAX_FEN ? length : 0;
+        memcpy(game->fen, fen, length);
+        game->fen[length] = 0;
+    } else {
+        snprintf(game->fen, sizeof(game->fen), "%s", START_FEN);
+    }
+    const char* result = tag_value(game, "Result", &length);
+    if (result != NULL){
+        game->result = parse_result(result, length);
+    } else {
+        // the termination marker closes the movetext
+        const char* end = game->moves + game->moves_length;
+        while (end > game->moves && isspace((unsigned char)end[-1])) end--;
+        game->result = PGN_NO_RESULT;
+        for (int n = 3; n <= 7 && end - game->moves >= n && game->result == PGN_NO_RESULT; n += 4){
+            game->result = parse_result(end - n, n);
+        }
+    }
+    return true;
+}
+
+/**
+ * Finds the legal move of the position written in standard algebraic notation.
+ * @param san The move, check and annotation marks are ignored.
+ * @param length Characters of the move.
+ * @param board The board state, unchanged when the function returns.
+ * @param out The move.
+ * @return false if no legal move matches.
+ */
+bool san_to_move(const char* san, size_t length, uint64_t* board, Move* out){
+    while (length > 0 && (san[length - 1] == '+' || san[length - 1] == '#' || san[length - 1] == '!' || san[length - 1] == '?')) length--;
+    int castle = 0; // 1 kingside, 2 queenside
+    if ((length == 3 && (strncmp(san, "O-O", 3) == 0 || strncmp(san, "0-0", 3) == 0))) castle = 1;
+    if ((length == 5 && (strncmp(san, "O-O-O", 5) == 0 || strncmp(san, "0-0-0", 5) == 0))) castle = 2;
+
+    int type = castle ? KING : 0; // offset from the side's pawn, knight = 1 ... king = 5
+    int promotion = 0;
+    int from_file = -1, from_rank = -1;
+    uint64_t to = 0;
+    if (!castle){
+        const char* p = san;
+        const char* end = san + length;
+        const char* pieces = "NBRQK";
+        if (p < end && *p != 0 && strchr(pieces, *p)){
+            type = strchr(pieces, *p) - pieces + 1;
+            p++;
+        }
+        if (end - p >= 4 && end[-2] == '=' && end[-1] != 0 && strchr("NBRQ", end[-1])){
+            promotion = strchr(pieces, end[-1]) - pieces + 1;
+            end -= 2;
+        } else if (type == 0 && end - p >= 3 && end[-1] != 0 && strchr("NBRQ", end[-1])){
+            promotion = strchr(pieces, end[-1]) - pieces + 1;
+            end--;
+        }
+        if (end - p < 2 || end[-2] < 'a' || end[-2] > 'h' || end[-1] < '1' || end[-1] > '8') return false;
+        to = UINT64_C(1) << (8 * (end[-1] - '1') + ('h' - end[-2]));
+        for (end -= 2; p < end; p++){
+            if (*p >= 'a' && *p <= 'h') from_file = *p;
+            else if (*p >= '1' && *p <= '8') from_rank = *p;
+            else if (*p != 'x' && *p != '-' && *p != ':') return false;
+        }
+    }
+
+    bool white = board[INFO] & TURN_BIT;
+    int side = white ? WHITE_PAWN : BLACK_PAWN;
+    Move movs[MOVES_ARRAY_LENGTH];
+    if (white){
+        get_white_moves(movs, board);
+    } else {
+        get_black_moves(movs, board);
+    }
+    for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+        if (movptr->pc1 != side + type) continue;
+        uint64_t from_sq = movptr->mov1 & board[movptr->pc1];
+        uint64_t to_sq = movptr->mov1 & ~board[movptr->pc1];
+        bool castling = type == KING && (to_sq == from_sq >> 2 || to_sq == from_sq << 2);
+        if (castle){
+            if (!castling || (castle == 1) != (to_sq == from_sq >> 2)) continue;
+        } else {
+            if (castling || to_sq != to) continue;
+            int sq = __builtin_ctzll(from_sq);
+            if (from_file >= 0 && 'h' - sq % 8 != from_file) continue;
+            if (from_rank >= 0 && '1' + sq / 8 != from_rank) continue;
+            int promoted = movptr->type == PROMOTE ? movptr->pc2 : movptr->type == CAPTURE_PROMOTE ? movptr->pc3 : -1;
+            if (promotion ? promoted != side + promotion : promoted >= 0) continue;
+        }
+        apply_move(movptr, board);
+        bool illegal = white ? (board[WHITE_KING] & get_black_attackers(board)) : (board[BLACK_KING] & get_white_attackers(board));
+        apply_move(movptr, board);
+        if (!illegal){
+            *out = *movptr;
+            return true;
+        }
+    }
+    return false;
+}
+
+// end of a comment or variation that starts at p, variations nest and may hold comments
+static const char* skip_aside(const char* p, const char* end){
+    int depth = 0;
+    for (; p < end; p++){
+        if (*p == '{'){
+            const char* close = memchr(p, '}', end - p);
+            if (close == NULL) return end;
+            p = close;
+        } else if (*p == ';'){
+            const char* newline = memchr(p, '\n', end - p);
+            if (newline == NULL) return end;
+            p = newline;
+        } else if (*p == '('){
+            depth++;
+        } else if (*p == ')'){
+            depth--;
+        }
+        if (depth <= 0) return p + 1;
+    }
+    return end;
+}
+
+/**
+ * Plays through the movetext of a game, from its FEN tag or the starting position.
+ * @param game The game, see next_pgn_game.
+ * @param max_plies Moves past this many are not replayed.
+ * @param visit Called with the position before each move, may be NULL.
+ * @param data Handed to visit.
+ * @return The number of moves replayed, or -1 if the start position or a move could not be read (the moves before it were visited).
+ */
+int replay_pgn_game(const PgnGame* game, int max_plies, PgnMoveVisitor visit, void* data){
+    if (game->fen[0] == 0) return -1;
+    uint64_t* board = from_FEN(game->fen);
+    if (__builtin_popcountll(board[WHITE_KING]) != 1 || __builtin_popcountll(board[BLACK_KING]) != 1){
+        free_board(board);
+        return -1;
+    }
+    int ply = 0;
+    const char* p = game->moves;
+    const char* end = game->moves + game->moves_length;
+    while (p < end && ply < max_plies){
+        char c = *p;
+        if (isspace((unsigned char)c) || c == '.' || c == ')'){
+            p++;
+        } else if (c == '{' || c == ';' || c == '('){
+            p = skip_aside(p, end);
+        } else if (c == '$'){
+            for (p++; p < end && isdigit((unsigned char)*p); p++);
+        } else if (c == '*' || parse_result(p, end - p) != PGN_NO_RESULT){
+            break;
+        } else if (isdigit((unsigned char)c) && !(end - p >= 3 && strncmp(p, "0-0", 3) == 0)){
+            for (p++; p < end && (isdigit((unsigned char)*p) || *p == '.'); p++); // move number
+        } else {
+            const char* token = p;
+            while (p < end && !isspace((unsigned char)*p) && *p != '{' && *p != '(' && *p != ')' && *p != ';' && *p != '$') p++;
+            Move move;
+            if (!san_to_move(token, p - token, board, &move)){
+                ply = -1;
+                break;
+            }
+            if (visit != NULL && !visit(board, &move, ply, game, data)){
+                ply++;
+                break;
+            }
+            apply_move(&move, board);
+            ply++;
+        }
+    }
+    free_board(board);
+    return ply;
+}
+
+// RECORD EXTRACTION
+
+typedef struct ExtractWorker {
+    pthread_t thread;
+    PgnCursor cursor;
+    int min_ply;
+    int max_ply;
+    long games;
+    long records;
+    long unreadable;
+    size_t used;
+    char* buffer; // PGN_WRITE_BUFFER bytes of records not yet written
+} ExtractWorker;
+
+static const char* RESULT_NAMES[] = {"0-1", "1/2-1/2", "1-0"};
+static FILE* records_file = NULL;
+static pthread_mutex_t records_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void flush_records(ExtractWorker* worker){
+    pthread_mutex_lock(&records_lock);
+    fwrite(worker->buffer, 1, worker->used, records_file);
+    pthread_mutex_unlock(&records_lock);
+    worker->used = 0;
+}
+
+static bool write_record(const uint64_t* board, const Move* move, int ply, const PgnGame* game, void* data){
+    ExtractWorker* worker = data;
+    if (ply < worker->min_ply) return true;
+    if (worker->used + PGN_RECORD_LENGTH > PGN_WRITE_BUFFER) flush_records(worker);
+    char fen[PGN_MAX_FEN];
+    to_FEN(board, ply_from_FEN(game->fen) + ply, fen, sizeof(fen));
+    char name[8];
+    format_uci_move((Move*)move, (uint64_t*)board, name, sizeof(name));
+    worker->used += snprintf(worker->buffer + worker->used, PGN_RECORD_LENGTH, "%s,%s,%s\n", fen, name, RESULT_NAMES[game->result]);
+    worker->records++;
+    return true;
+}
+
+static void* extract_worker(void* arg){
+    ExtractWorker* worker = arg;
+    PgnGame game;
+    while (next_pgn_game(&worker->cursor, &game)){
+        if (game.result == PGN_NO_RESULT) continue;
+        worker->games++;
+        if (replay_pgn_game(&game, worker->max_ply, write_record, worker) < 0) worker->unreadable++;
+    }
+    if (worker->used > 0) flush_records(worker);
+    return NULL;
+}
+
+/**
+ * Writes a record of every move of the games, "FEN,move,result" with the position before the move, the move in UCI notation and the
+ * game's result. Games without a result are skipped, records of different games may be interleaved between threads.
+ * @param out_filename The records file, it starts with a header line.
+ * @param pgn_filenames The game collections.
+ * @param num_files The number of game collections.
+ * @param num_threads Worker threads, 0 for one per core.
+ * @param min_ply Moves before this ply are not written, to leave out the opening.
+ * @param max_ply Moves from this ply on are not written.
+ * @return The number of records written, or -1 if the output cannot be written.
+ */
+long extract_pgn_records(const char* out_filename, const char** pgn_filenames, int num_files, int num_threads, int min_ply, int max_ply){
+    if (num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = max(num_threads, 1);
+    records_file = fopen(out_filename, "w");
+    if (!records_file){
+        printf("Error opening file\n");
+        return -1;
+    }
+    fprintf(records_file, "fen,move,result\n");
+    ExtractWorker* workers = calloc(num_threads, sizeof(ExtractWorker));
+    for (int t = 0; workers != NULL && t < num_threads; t++){
+        workers[t].buffer = malloc(PGN_WRITE_BUFFER);
+        if (workers[t].buffer == NULL) num_threads = t;
+    }
+    if (workers == NULL || num_threads == 0){
+        printf("Error allocating record buffers\n");
+        free(workers);
+        fclose(records_file);
+        return -1;
+    }
+
+    long total = 0;
+    for (int f = 0; f < num_files; f++){
+        PgnFile pgn;
+        if (!open_pgn(&pgn, pgn_filenames[f])) continue;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t range = pgn.size / num_threads + 1;
+        for (int t = 0; t < num_threads; t++){
+            char* buffer = workers[t].buffer;
+            workers[t] = (ExtractWorker){0};
+            workers[t].buffer = buffer;
+            workers[t].cursor = pgn_range(&pgn, t * range, (t + 1) * range);
+            workers[t].min_ply = min_ply;
+            workers[t].max_ply = max_ply;
+        }
+        for (int t = 0; t < num_threads; t++){
+            if (pthread_create(&workers[t].thread, NULL, extract_worker, &workers[t]) != 0){
+                extract_worker(&workers[t]);
+                workers[t].thread = 0;
+            }
+        }
+        long games = 0, records = 0, unreadable = 0;
+        for (int t = 0; t < num_threads; t++){
+            if (workers[t].thread) pthread_join(workers[t].thread, NULL);
+            games += workers[t].games;
+            records += workers[t].records;
+            unreadable += workers[t].unreadable;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%s: %ld games, %ld records, %ld games with unreadable moves, %.0f games/minute\n", pgn_filenames[f], games, records, unreadable,
+            games * 60 / (seconds > 0 ? seconds : 1e-9));
+        close_pgn(&pgn);
+        total += records;
+    }
+    for (int t = 0; t < num_threads; t++) free(workers[t].buffer);
+    free(workers);
+    bool ok = !ferror(records_file);
+    ok = fclose(records_file) == 0 && ok;
+    records_file = NULL;
+    return ok ? total : -1;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "get_moves.h"
+
+#define PGN_MAX_FEN 128
+#define PGN_RELEASE_CHUNK ((size_t)64 << 20) // pages read past are dropped in steps of this many bytes
+#define PGN_WRITE_BUFFER (1 << 20) // bytes of records a worker gathers before writing them out
+#define PGN_RECORD_LENGTH 160 // longest record line: FEN, move and result
+
+// game results, on the scale of the tuner's labels
+enum PGN_RESULT {
+    PGN_BLACK_WIN = 0,
+    PGN_DRAW = 1,
+    PGN_WHITE_WIN = 2,
+    PGN_NO_RESULT = 3 // "*" or missing
+};
+
+// a PGN file mapped into memory
+typedef struct PgnFile {
+    const char* data;
+    size_t size;
+} PgnFile;
+
+// reads the games that start in a byte range of the file, so that several threads can share one file
+typedef struct PgnCursor {
+    const PgnFile* file;
+    size_t pos;
+    size_t end;
+    size_t released; // bytes before this have been given back to the kernel
+} PgnCursor;
+
+// one game, its tags and movetext point into the mapped file
+typedef struct PgnGame {
+    const char* tags;
+    size_t tags_length;
+    const char* moves;
+    size_t moves_length;
+    char fen[PGN_MAX_FEN]; // of the FEN tag, or the starting position
+    int result;
+} PgnGame;
+
+// called for each move of a replayed game with the position before it, returns false to stop the replay
+typedef bool (*PgnMoveVisitor)(const uint64_t* board, const Move* move, int ply, const PgnGame* game, void* data);
+
+bool open_pgn(PgnFile* pgn, const char* filename);
+void close_pgn(PgnFile* pgn);
+PgnCursor pgn_range(const PgnFile* pgn, size_t start, size_t end);
+bool next_pgn_game(PgnCursor* cursor, PgnGame* game);
+bool san_to_move(const char* san, size_t length, uint64_t* board, Move* out);
+int replay_pgn_game(const PgnGame* game, int max_plies, PgnMoveVisitor visit, void* data);
+long extract_pgn_records(const char* out_filename, const char** pgn_filenames, int num_files, int num_threads, int min_ply, int max_ply);
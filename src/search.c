@@ -3,46 +3,342 @@
 #include "eval.h"
 #include "helpers.h"
 #include "get_moves.h"
+#include "tbprobe.h"
+#include "hash_table.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
+#include <time.h>
 
-// main serach function
-searchResult* search(unsigned long long* board, int iter, int16_t alpha, int16_t beta){    
+// ENGINE CONTEXT
+
+/**
+ * @return a new engine with an empty transposition table, NULL if out of memory
+ */
+Engine* create_engine(){
+    initialize_zobrist();
+    Engine* engine = calloc(1, sizeof(Engine));
+    if (engine == NULL) return NULL;
+    if (!initilize_trans_table(&engine->tt, TT_DEFAULT_MB)){
+        free(engine);
+        return NULL;
+    }
+    return engine;
+}
+
+/**
+ * Frees an engine and its transposition table, the engine must not be searching.
+ */
+void free_engine(Engine* engine){
+    if (engine == NULL) return;
+    free_trans_table(&engine->tt);
+    free(engine);
+}
+
+/**
+ * Forgets the transposition table (unless it is shared with other processes) and history heuristic scores of an engine, for a new game.
+ */
+void clear_engine(Engine* engine){
+    clear_trans_table(&engine->tt);
+    memset(engine->history, 0, sizeof(engine->history));
+}
+
+// SEARCH CONTROL
+// searches may run on a worker thread (see uci.c). stop can be raised at any time from another thread, or by the node check once the
+// time limit has passed, and unwinds the search within a few thousand nodes. the result of a stopped search is incomplete and has to
+// be discarded by the caller
+
+#define NODE_CHECK_INTERVAL 2048 // nodes between clock reads, must be a power of two
+#define INFO_INTERVAL_MS 1000
+
+/**
+ * @return the counters of the engine's current search
+ */
+SearchStats get_search_stats(const Engine* engine){
+    return engine->stats;
+}
+
+/**
+ * Records the iteration the engine is searching, for the info lines.
+ */
+void set_search_depth(Engine* engine, int depth){
+    engine->stats.depth = depth;
+}
+
+/**
+ * Starts the clock of a new search and resets its counters. The stop flag is cleared by the caller before the search is handed to
+ * its thread, so a stop sent in between is not lost.
+ * @param time_limit ms after which the search stops itself, 0 for no limit
+ * @param info called about once a second while the search runs, may be NULL
+ */
+void start_search_clock(Engine* engine, long time_limit, void (*info)(Engine* engine, long elapsed)){
+    clock_gettime(CLOCK_MONOTONIC, &engine->start);
+    engine->time_limit = time_limit;
+    engine->info = info;
+    engine->next_info = INFO_INTERVAL_MS;
+    memset(&engine->stats, 0, sizeof(engine->stats));
+    engine->ply = 0;
+}
+
+/**
+ * Changes the time limit of the running search, used when a ponder search becomes a timed one. May be called from another thread.
+ * @param time_limit ms since the start of the search, 0 for no limit
+ */
+void set_search_time_limit(Engine* engine, long time_limit){
+    __atomic_store_n(&engine->time_limit, time_limit, __ATOMIC_RELAXED);
+}
+
+/**
+ * @return wall clock ms since start_search_clock
+ */
+long search_elapsed(const Engine* engine){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - engine->start.tv_sec) * 1000 + (now.tv_nsec - engine->start.tv_nsec) / 1000000;
+}
+
+static inline bool check_stop(Engine* e){
+    if (e->ply > e->stats.seldepth) e->stats.seldepth = e->ply;
+    if ((++e->stats.nodes & (NODE_CHECK_INTERVAL - 1)) == 0){
+        long time_limit = __atomic_load_n(&e->time_limit, __ATOMIC_RELAXED);
+        long elapsed = time_limit || e->info ? search_elapsed(e) : 0;
+        if (time_limit && elapsed >= time_limit) e->stop = true;
+        if (e->info && elapsed >= e->next_info){
+            e->info(e, elapsed);
+            e->next_info = elapsed + INFO_INTERVAL_MS;
+        }
+    }
+    return e->stop;
+}
+
+// SEARCH PROFILE
+// compiled in with -DSEARCH_PROFILE: counts per ply where the tree goes, to tune move ordering and pruning. the counters are shared
+// by all engines without locking, so profile a single search at a time (the bench, or a UCI search)
+
+#ifdef SEARCH_PROFILE
+typedef struct PlyProfile {
+    uint64_t nodes;
+    uint64_t pseudo_moves; // made to test their legality
+    uint64_t illegal_moves; // left the own king in check
+    uint64_t cutoffs;
+    uint64_t first_move_cutoffs; // by the first legal move
+    uint64_t tt_probes;
+    uint64_t tt_hits; // the table had a move that was in the move list
+    uint64_t tt_cutoffs; // by the table's move
+} PlyProfile;
+
+static PlyProfile profile[MAX_SEARCH_DEPTH + 1];
+#define PROFILE(stat) (profile[min(e->ply, MAX_SEARCH_DEPTH)].stat++)
+#else
+#define PROFILE(stat) ((void)0)
+#endif
+
+/**
+ * Clears the search profile, a no-op unless compiled with SEARCH_PROFILE.
+ */
+void reset_search_profile(){
+#ifdef SEARCH_PROFILE
+    memset(profile, 0, sizeof(profile));
+#endif
+}
+
+/**
+ * Writes the search profile as JSON: per ply the node count, effective branching factor (nodes of the next ply per node), share of
+ * cutoffs made by the first legal move, transposition table hit and cutoff rates, and share of pseudo legal moves that were illegal.
+ * @param filename The file to write.
+ * @return false if the profile was not compiled in (SEARCH_PROFILE) or the file could not be written.
+ */
+bool dump_search_profile(const char* filename){
+#ifdef SEARCH_PROFILE
+    FILE* file = fopen(filename, "w");
+    if (file == NULL){
+        printf("Error opening file\n");
+        return false;
+    }
+    int plies = 0;
+    while (plies <= MAX_SEARCH_DEPTH && profile[plies].nodes) plies++;
+    fprintf(file, "{\"plies\": [\n");
+    for (int p = 0; p < plies; p++){
+        const PlyProfile* pr = &profile[p];
+        fprintf(file, "  {\"ply\": %d, \"nodes\": %llu, \"ebf\": %.3f, \"cutoffs\": %llu, \"first_move_cutoff_rate\": %.4f, "
+            "\"tt_probes\": %llu, \"tt_hit_rate\": %.4f, \"tt_cutoff_rate\": %.4f, \"pseudo_moves\": %llu, \"illegal_share\": %.4f}%s\n",
+            p, (unsigned long long)pr->nodes, p + 1 < plies ? (double)profile[p + 1].nodes / pr->nodes : 0.0, (unsigned long long)pr->cutoffs,
+            pr->cutoffs ? (double)pr->first_move_cutoffs / pr->cutoffs : 0.0, (unsigned long long)pr->tt_probes,
+            pr->tt_probes ? (double)pr->tt_hits / pr->tt_probes : 0.0, pr->tt_hits ? (double)pr->tt_cutoffs / pr->tt_hits : 0.0,
+            (unsigned long long)pr->pseudo_moves, pr->pseudo_moves ? (double)pr->illegal_moves / pr->pseudo_moves : 0.0, p + 1 < plies ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+    return true;
+#else
+    (void)filename;
+    return false;
+#endif
+}
+
+// MOVE ORDERING
+// the transposition table remembers the best move of positions searched before (in earlier iterations or for earlier moves of the
+// game) and is tried first, quiet moves are ordered by how often they caused beta cutoffs. both persist between the searches of an
+// engine until clear_engine
+
+#define HISTORY_LIMIT (1 << 20) // history scores are halved when one reaches the limit
+#define TT_MIN_DEPTH 2 // shallower nodes are not worth a table lookup
+
+static inline int quiet_destination(const Move* m, const uint64_t* board){
+    return __builtin_ctzll(m->mov1 & ~board[m->pc1]);
+}
+
+/**
+ * @return true if both moves move the same pieces between the same squares
+ */
+bool same_move(const Move* a, const Move* b){
+    if (a->type != b->type || a->pc1 != b->pc1 || a->mov1 != b->mov1) return false;
+    if (a->type == EMPTY) return true;
+    if (a->pc2 != b->pc2 || __builtin_ctzll(a->mov2) != __builtin_ctzll(b->mov2)) return false;
+    return a->type != CAPTURE_PROMOTE || (a->pc3 == b->pc3 && a->mov3 == b->mov3);
+}
+
+// returns true if the transposition table move was put first
+static bool order_moves(Engine* e, Move* movs, const uint64_t* board, uint64_t hash, int iter){
+    int (*history)[64] = e->history;
+    int count = 0;
+    while (movs[count].type != BOOK_END) count++;
+
+    // quiet moves are at the end of the generated list, insertion sort them by history
+    int first_quiet = count;
+    while (first_quiet > 0 && movs[first_quiet - 1].type == EMPTY) first_quiet--;
+    for (int i = first_quiet + 1; i < count; i++){
+        Move m = movs[i];
+        int score = history[m.pc1][quiet_destination(&m, board)];
+        int j = i - 1;
+        while (j >= first_quiet && history[movs[j].pc1][quiet_destination(&movs[j], board)] < score){
+            movs[j + 1] = movs[j];
+            j--;
+        }
+        movs[j + 1] = m;
+    }
+
+    // transposition table move first
+    if (iter < TT_MIN_DEPTH) return false;
+    PROFILE(tt_probes);
+    TTEntry entry;
+    if (!query_table(&e->tt, hash, &entry)) return false;
+    Move tt_move = TT_ENTRY_MOVE(&entry);
+    for (int i = 0; i < count; i++){
+        if (same_move(&movs[i], &tt_move)){
+            Move m = movs[i];
+            memmove(movs + 1, movs, i * sizeof(Move));
+            movs[0] = m;
+            PROFILE(tt_hits);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void update_history(Engine* e, const Move* m, const uint64_t* board, int iter){
+    if (m->type != EMPTY) return;
+    int (*history)[64] = e->history;
+    int* score = &history[m->pc1][quiet_destination(m, board)];
+    *score += iter * iter;
+    if (*score >= HISTORY_LIMIT){
+        for (int pc = 0; pc < 12; pc++){
+            for (int sq = 0; sq < 64; sq++){
+                history[pc][sq] /= 2;
+            }
+        }
+    }
+}
+
+// exact result from the syzygy tables for the position after a capture or pawn move, where the 50 move counter is reset and the
+// WDL tables are exact. NULL if the position is not in the tables or too close to the horizon to be worth the probe
+static searchResult* tablebase_result(Engine* e, uint64_t* board, const Move* move, int iter){
+    bool zeroing = move->type == CAPTURE_PROMOTE || move->pc1 == WHITE_PAWN || move->pc1 == BLACK_PAWN
+                || (move->type == CAPTURE && (move->pc1 < BLACK_PAWN) != (move->pc2 < BLACK_PAWN));
+    if (!zeroing || !tb_can_probe(board)){
+        return NULL;
+    }
+    // below the cardinality every probe pays off, at it only with enough depth left
+    if (__builtin_popcountll(board[WHITE_PCS] | board[BLACK_PCS]) == tb_cardinality() && iter < SyzygyProbeDepth){
+        return NULL;
+    }
+    bool success;
+    int wdl = tb_probe_wdl(board, &success);
+    if (!success){
+        return NULL;
+    }
+    e->stats.tb_hits++;
+    // cursed wins and blessed losses are draws by the 50 move rule, keep a slight preference
+    int16_t eval = wdl == TB_WIN ? TB_WIN_SCORE + iter : wdl == TB_LOSS ? -(TB_WIN_SCORE + iter) : wdl;
+    searchResult* result = malloc(sizeof(searchResult));
+    if (result == NULL){
+        return NULL; // out of memory, the position is searched instead
+    }
+    result->best_result = NULL;
+    result->best_move.type = BOOK_END;
+    result->best_eval = (board[INFO] & TURN_BIT) ? eval : -eval;
+    return result;
+}
+
+// main serach function, hash is the position's zobrist hash when iter >= TT_MIN_DEPTH. it is updated by move_hash_delta as moves
+// are made and the child's table bucket is prefetched straight away, the probe at the child then finds it in cache
+static searchResult* search_node(Engine* e, uint64_t* board, uint64_t hash, int iter, int16_t alpha, int16_t beta){
     searchResult* this_result = malloc(sizeof(searchResult));
     this_result->best_result = NULL;
     this_result->best_move.type = BOOK_END;
     
-    // if end of iteration, return evaluation of board
-    if (!iter){
+    // if end of iteration or the search was stopped, return evaluation of board
+    PROFILE(nodes);
+    if (check_stop(e) || !iter){
         this_result->best_eval = evaluate(board);
         return this_result;
     }
     
+    const int16_t alpha_start = alpha, beta_start = beta;
+
     // initialize move array large enough for most possible moves in a chess position (219) with head room (240) to account for varying piece promotions
     Move movs[MOVES_ARRAY_LENGTH];
     if (board[INFO] & TURN_BIT){ // white
         this_result->best_eval = INT16_MIN;
         get_white_moves(movs,board);
+        bool tt_first = order_moves(e, movs, board, hash, iter);
         Move* best_move_ptr = NULL;
+        int legal_moves = 0;
         
         for (Move* movptr = &(movs[0]); movptr -> type != BOOK_END; movptr++){
             apply_move(movptr,board);
+            uint64_t child_hash = 0;
+            if (iter > TT_MIN_DEPTH){
+                child_hash = hash ^ move_hash_delta(movptr);
+                prefetch_bucket(&e->tt, child_hash);
+            }
            
             assert((board[INFO] & TURN_BIT) == 0);
             
             // check if move leaves white king in check
+            PROFILE(pseudo_moves);
             if (board[WHITE_KING] & get_black_attackers(board)){
+                PROFILE(illegal_moves);
                 apply_move(movptr,board);
                 continue;
             }
+            legal_moves++;
             
-            searchResult* child_result = search(board, iter - 1, alpha, beta);
+            searchResult* child_result = tablebase_result(e, board, movptr, iter - 1);
+            if (child_result == NULL){
+                e->ply++;
+                child_result = search_node(e, board, child_hash, iter - 1, alpha, beta);
+                e->ply--;
+            }
             apply_move(movptr,board);
 
+            if (e->stop){
+                free_search_result(child_result);
+                break;
+            }
 
             if (child_result->best_eval > this_result->best_eval){
                 free_search_result(this_result->best_result); // free old best move
@@ -54,6 +350,10 @@ searchResult* search(unsigned long long* board, int iter, int16_t alpha, int16_t
 
             // alpha-beta pruning
             if (this_result->best_eval >= beta){
+                PROFILE(cutoffs);
+                if (legal_moves == 1) PROFILE(first_move_cutoffs);
+                if (tt_first && movptr == movs) PROFILE(tt_cutoffs);
+                update_history(e, movptr, board, iter);
                 break;
                 if (this_result -> best_result != child_result){
                     free_search_result(child_result);
@@ -67,6 +367,10 @@ searchResult* search(unsigned long long* board, int iter, int16_t alpha, int16_t
         // copy best move to search return
         if (best_move_ptr != NULL){
             this_result->best_move = copy_move(best_move_ptr);
+            if (iter >= TT_MIN_DEPTH && !e->stop){
+                int bound = this_result->best_eval >= beta_start ? LOWER_BOUND : this_result->best_eval <= alpha_start ? UPPER_BOUND : EXACT;
+                add_item(&e->tt, best_move_ptr, bound, iter, hash);
+            }
         } else { // if no valid move found we have either a checkmate or a stalemate
             // test if king is in check to determine checkmate vs stalemate, apply checkmate eval function to incentivise checkmates as soon as possible (prevents playing wiht the opponent forever)
             this_result->best_eval = (board[WHITE_KING] & get_black_attackers(board)) ? -(CHECKMATE_EVAL - EARLY_CHECKMATE_INCENTIVE / (iter + 1)) : 0;
@@ -74,20 +378,40 @@ searchResult* search(unsigned long long* board, int iter, int16_t alpha, int16_t
     } else { // black
         this_result->best_eval = INT16_MAX;
         get_black_moves(movs, board);
+        bool tt_first = order_moves(e, movs, board, hash, iter);
         Move* best_move_ptr = NULL;
+        int legal_moves = 0;
 
         for (Move* movptr = &(movs[0]); movptr -> type != BOOK_END; movptr++){
             apply_move(movptr,board);
+            uint64_t child_hash = 0;
+            if (iter > TT_MIN_DEPTH){
+                child_hash = hash ^ move_hash_delta(movptr);
+                prefetch_bucket(&e->tt, child_hash);
+            }
             
             assert(board[INFO] & TURN_BIT);
             
             // check if move leaaves black king in check
+            PROFILE(pseudo_moves);
             if (board[BLACK_KING] & get_white_attackers(board)){
+                PROFILE(illegal_moves);
                 apply_move(movptr,board);
                 continue;
             }
-            searchResult* child_result = search(board, iter - 1, alpha, beta);
+            legal_moves++;
+            searchResult* child_result = tablebase_result(e, board, movptr, iter - 1);
+            if (child_result == NULL){
+                e->ply++;
+                child_result = search_node(e, board, child_hash, iter - 1, alpha, beta);
+                e->ply--;
+            }
             apply_move(movptr,board);
+
+            if (e->stop){
+                free_search_result(child_result);
+                break;
+            }
             
             if (child_result->best_eval < this_result->best_eval){ // same as for white
                 free_search_result(this_result->best_result);
@@ -97,6 +421,10 @@ searchResult* search(unsigned long long* board, int iter, int16_t alpha, int16_t
                 beta = min(child_result->best_eval,beta);  
             } 
             if (child_result->best_eval <= alpha){
+                PROFILE(cutoffs);
+                if (legal_moves == 1) PROFILE(first_move_cutoffs);
+                if (tt_first && movptr == movs) PROFILE(tt_cutoffs);
+                update_history(e, movptr, board, iter);
                 break;
                 if (this_result -> best_result != child_result){
                     free_search_result(child_result);
@@ -109,9 +437,25 @@ searchResult* search(unsigned long long* board, int iter, int16_t alpha, int16_t
         // same as for white
         if (best_move_ptr != NULL){
             this_result->best_move = copy_move(best_move_ptr);
+            if (iter >= TT_MIN_DEPTH && !e->stop){
+                int bound = this_result->best_eval >= beta_start ? LOWER_BOUND : this_result->best_eval <= alpha_start ? UPPER_BOUND : EXACT;
+                add_item(&e->tt, best_move_ptr, bound, iter, hash);
+            }
         } else {
             this_result->best_eval = (board[BLACK_KING] & get_white_attackers(board)) ? (CHECKMATE_EVAL - EARLY_CHECKMATE_INCENTIVE / (iter + 1)) : 0;
         }
     }
     return this_result;
-}
\ No newline at end of file
+}
+
+/**
+ * Searches a position to a fixed depth with alpha-beta pruning.
+ * @param engine Its transposition table, history scores, clock and stop flag are used.
+ * @param board The position, left unchanged.
+ * @param iter The depth in plies.
+ * @return The best move and evaluation (white's point of view) with the principal variation chained behind them, to be freed with
+ * free_search_result.
+ */
+searchResult* search(Engine* engine, uint64_t* board, int iter, int16_t alpha, int16_t beta){
+    return search_node(engine, board, iter >= TT_MIN_DEPTH ? get_hash(board) : 0, iter, alpha, beta);
+}
@@ -2,9 +2,13 @@
 #include "constants.h"
 #include "stdbool.h"
 #include "get_moves.h"
+#include "hash_table.h"
+#include <time.h>
 
 # define CHECKMATE_EVAL 30000
 # define EARLY_CHECKMATE_INCENTIVE 2000
+# define is_mate_score(eval) ((eval) >= CHECKMATE_EVAL - EARLY_CHECKMATE_INCENTIVE || (eval) <= -(CHECKMATE_EVAL - EARLY_CHECKMATE_INCENTIVE))
+# define MAX_SEARCH_DEPTH 63 // the transposition table stores depths in 6 bits
 
 typedef struct SearchResult{
     Move best_move;
@@ -12,4 +16,42 @@ typedef struct SearchResult{
     struct SearchResult* best_result;
   } searchResult;
 
-searchResult *search(long long unsigned int *board, int iter, int16_t alpha, int16_t beta);
+# define SEARCH_PROFILE_FILE "search_profile.json" // written after each search when compiled with -DSEARCH_PROFILE
+
+// counters of one search, see get_search_stats
+typedef struct SearchStats {
+    uint64_t nodes;
+    uint64_t tb_hits;
+    int depth; // iteration being searched
+    int seldepth; // deepest ply reached
+} SearchStats;
+
+// ENGINE CONTEXT
+// everything a search writes to: its transposition table, history scores, clock, stop flag and counters. an engine searches on one
+// thread at a time, any number of engines can search concurrently. the tables they only read (zobrist keys, evaluation parameters,
+// material table, bitbases and tablebases) are set up once per process and shared
+typedef struct Engine {
+    TransTable tt;
+    int history[12][64]; // piece and destination square of quiet moves
+    volatile bool stop; // raised by another thread or the clock, see start_search_clock
+    struct timespec start;
+    long time_limit; // ms, 0 for none. read and written atomically, see set_search_time_limit
+    long next_info;
+    void (*info)(struct Engine* engine, long elapsed);
+    void* user_data; // for the info callback
+    SearchStats stats;
+    int ply; // of the node being searched, from the root
+} Engine;
+
+Engine* create_engine();
+void free_engine(Engine* engine);
+void clear_engine(Engine* engine);
+searchResult *search(Engine* engine, uint64_t *board, int iter, int16_t alpha, int16_t beta);
+bool same_move(const Move* a, const Move* b);
+void start_search_clock(Engine* engine, long time_limit, void (*info)(Engine* engine, long elapsed));
+void set_search_depth(Engine* engine, int depth);
+SearchStats get_search_stats(const Engine* engine);
+void reset_search_profile();
+bool dump_search_profile(const char* filename);
+void set_search_time_limit(Engine* engine, long time_limit);
+long search_elapsed(const Engine* engine);
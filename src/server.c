@@ -0,0 +1,542 @@
+#include "server.h"
+#include "constants.h"
+#include "get_moves.h"
+#include "search.h"
+#include "helpers.h"
+#include "time_manager.h"
+#include "tbprobe.h"
+#include "uci.h"
+#include "hash_table.h"
+#include "analysis_cache.h"
+#include "book.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+// GAME SERVER
+// hosts many games in one process: every connection to the Unix socket is a session with its own position, and its searches are
+// run by a fixed pool of workers. a session speaks a subset of UCI, one command per line:
+//      position startpos|fen <fen> [moves <move>...]
+//      go [depth <plies>] [movetime <ms>] [wtime <ms> btime <ms> winc <ms> binc <ms> movestogo <moves>]
+//      stop, isready, ucinewgame, quit
+// and is answered with the info line of every completed iteration and "bestmove <move> [ponder <move>]". a session has at most one
+// search queued or running, a "go" sent meanwhile is refused.
+//
+// fair queuing: a free worker takes the queued session that has used the least search time so far, so a session playing long time
+// controls cannot starve the blitz games. each search gets the budget of its own time controls (see time_manager.c), less the time
+// it waited in the queue since the session's clock was running, and never more than the server's max movetime.
+//
+// every worker owns an Engine, so memory is bounded by the pool and not by the number of games. the transposition table is keyed by
+// the full hash, so the games sharing a worker do not disturb each other's results, they only share table space and history scores
+
+enum SESSION_STATE {
+    SESSION_IDLE,
+    SESSION_QUEUED,
+    SESSION_SEARCHING
+};
+
+// a "go" of a session, copied out of it when a worker takes it
+typedef struct SearchRequest {
+    uint64_t board[BOARD_ARRAY_SIZE];
+    int ply; // of the game, for the book
+    int max_depth;
+    TimeLimits limits;
+    struct timespec queued; // when the go arrived
+} SearchRequest;
+
+typedef struct Worker Worker;
+
+typedef struct Session {
+    int fd;
+    char buffer[SERVER_LINE_LENGTH]; // received bytes of an incomplete line
+    size_t buffered;
+    uint64_t board[BOARD_ARRAY_SIZE];
+    int ply;
+    SearchRequest request;
+    enum SESSION_STATE state;
+    int users; // workers still sending to the session, it is freed by the last one once closed
+    bool closed; // the client has gone
+    long used_ms; // search time used, the queue serves the session with the least first
+    Worker* worker; // while searching
+    pthread_mutex_t write_lock; // replies come from the server thread and the worker
+} Session;
+
+struct Worker {
+    pthread_t thread;
+    Engine* engine;
+};
+
+static Session* sessions[SERVER_MAX_SESSIONS]; // connected, in connection order
+static int num_sessions = 0;
+static Session* queue[SERVER_MAX_SESSIONS]; // waiting for a worker
+static int queue_length = 0;
+static Worker* workers = NULL;
+static int num_workers = 0;
+static long server_max_movetime = SERVER_MAX_MOVETIME;
+static bool shutting_down = false;
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER; // sessions' states, the queue and shutting_down
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+
+static long ms_since(const struct timespec* start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// sends one line to the client, a client that has gone away is noticed by the server thread's next read
+static void send_line(Session* s, const char* line){
+    pthread_mutex_lock(&s->write_lock);
+    size_t length = strlen(line);
+    for (size_t sent = 0; sent < length;){
+        ssize_t n = send(s->fd, line + sent, length - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        sent += n;
+    }
+    send(s->fd, "\n", 1, MSG_NOSIGNAL);
+    pthread_mutex_unlock(&s->write_lock);
+}
+
+static void free_session(Session* s){
+    close(s->fd);
+    pthread_mutex_destroy(&s->write_lock);
+    free(s);
+}
+
+// SEARCH WORKERS
+
+// iterative deepening on the worker's engine, only completed iterations are reported. the bestmove line is left for the caller to
+// send once the session is idle again, so a client may answer it with its next go straight away
+static long run_search(Session* s, Engine* engine, SearchRequest* request, char* bestmove, size_t size){
+    uint64_t* board = request->board;
+    char line[UCI_INFO_LENGTH];
+    long waited = ms_since(&request->queued);
+
+    // known theory is played from the book
+    Move book_move;
+    if (probe_book(board, request->ply, &book_move)){
+        char name[8];
+        format_uci_move(&book_move, board, name, sizeof(name));
+        snprintf(line, sizeof(line), "info string book move %s", name);
+        send_line(s, line);
+        snprintf(bestmove, size, "bestmove %s", name);
+        return 0;
+    }
+
+    // a root in the tablebases is answered from the DTZ tables
+    Move tb_move;
+    int wdl;
+    if (tb_probe_root(board, &tb_move, &wdl)){
+        char name[8];
+        format_uci_move(&tb_move, board, name, sizeof(name));
+        snprintf(line, sizeof(line), "info depth 1 seldepth 1 score cp %d nodes 1 tbhits 1 time 0 pv %s", wdl == TB_WIN ? TB_WIN_SCORE : wdl == TB_LOSS ? -TB_WIN_SCORE : wdl, name);
+        send_line(s, line);
+        snprintf(bestmove, size, "bestmove %s", name);
+        return 0;
+    }
+
+    // the client's clock has been running while the request was queued
+    TimeLimits limits = request->limits;
+    if (limits.time_left >= 0) limits.time_left = max(limits.time_left - waited, 0);
+    if (limits.movetime > 0) limits.movetime = max(limits.movetime - waited, 1);
+    TimeManager tm;
+    init_time_manager(&tm, &limits, 0);
+    long hard = tm.limited ? min(tm.hard, server_max_movetime) : server_max_movetime;
+    start_search_clock(engine, hard, NULL);
+
+    // a deep enough search of an earlier run is the answer, a shallower one seeds the transposition table
+    int best_depth = 0;
+    searchResult* best = consult_analysis_cache(board, request->max_depth < MAX_SEARCH_DEPTH ? request->max_depth : AnalysisCacheDepth, &engine->tt, &best_depth);
+    bool cached = best != NULL;
+    if (cached){
+        format_search_info(line, sizeof(line), engine, best, board, best_depth, 0);
+        send_line(s, line);
+    }
+
+    Move legal[MOVES_ARRAY_LENGTH];
+    int num_legal = get_legal_moves(legal, board);
+    bool forced = num_legal == 1;
+    for (int depth = 1; !cached && depth <= request->max_depth; depth++){
+        set_search_depth(engine, depth);
+        searchResult* result = search(engine, board, depth, INT16_MIN, INT16_MAX);
+        if (engine->stop && best != NULL){
+            free_search_result(result); // incomplete iteration
+            break;
+        }
+        free_search_result(best);
+        best = result;
+        best_depth = depth;
+
+        long elapsed = search_elapsed(engine);
+        format_search_info(line, sizeof(line), engine, best, board, depth, elapsed);
+        send_line(s, line);
+        if (engine->stop || best->best_move.type == BOOK_END) break;
+        if (tm.limited && (forced || !time_for_next_iteration(&tm, best, elapsed))) break;
+    }
+    // a stop before the first iteration searched any root move leaves it without one, a legal move beats "bestmove 0000"
+    if (best->best_move.type == BOOK_END && num_legal > 0){
+        best->best_move = legal[0];
+    }
+
+    if (!cached){
+        record_analysis(board, best, best_depth);
+    }
+    if (best->best_move.type == BOOK_END){
+        snprintf(bestmove, size, "bestmove 0000"); // mate or stalemate at the root
+    } else {
+        char name[8], reply_name[8];
+        format_uci_move(&best->best_move, board, name, sizeof(name));
+        searchResult* reply = best->best_result;
+        if (reply != NULL && reply->best_move.type != BOOK_END){
+            apply_move(&best->best_move, board);
+            format_uci_move(&reply->best_move, board, reply_name, sizeof(reply_name));
+            apply_move(&best->best_move, board);
+            snprintf(bestmove, size, "bestmove %s ponder %s", name, reply_name);
+        } else {
+            snprintf(bestmove, size, "bestmove %s", name);
+        }
+    }
+    free_search_result(best);
+    return search_elapsed(engine);
+}
+
+// takes the queued session with the least search time used, the one queued first among equals. called with the server lock held
+static Session* next_session(){
+    int fairest = 0;
+    for (int i = 1; i < queue_length; i++){
+        if (queue[i]->used_ms < queue[fairest]->used_ms) fairest = i;
+    }
+    Session* s = queue[fairest];
+    memmove(queue + fairest, queue + fairest + 1, (queue_length - fairest - 1) * sizeof(Session*));
+    queue_length--;
+    return s;
+}
+
+static void* server_worker(void* arg){
+    Worker* w = arg;
+    SearchRequest request;
+    char bestmove[64];
+    pthread_mutex_lock(&server_lock);
+    while (true){
+        while (queue_length == 0 && !shutting_down) pthread_cond_wait(&queue_ready, &server_lock);
+        if (shutting_down) break;
+        Session* s = next_session();
+        s->state = SESSION_SEARCHING;
+        s->worker = w;
+        s->users++;
+        request = s->request;
+        w->engine->stop = false; // a stop for this session from now on is sent to the engine, see stop_session
+        pthread_mutex_unlock(&server_lock);
+
+        long used = run_search(s, w->engine, &request, bestmove, sizeof(bestmove));
+
+        pthread_mutex_lock(&server_lock);
+        s->used_ms += used;
+        s->state = SESSION_IDLE;
+        s->worker = NULL;
+        pthread_mutex_unlock(&server_lock);
+        send_line(s, bestmove);
+
+        pthread_mutex_lock(&server_lock);
+        if (--s->users == 0 && s->closed){
+            free_session(s);
+        }
+    }
+    pthread_mutex_unlock(&server_lock);
+    return NULL;
+}
+
+// SESSION COMMANDS
+// handled on the server thread, which only reads a session's position and state while no worker can change them
+
+// a stopped queued search still has to answer, it is cut down to one iteration. called with the server lock held
+static void stop_session(Session* s){
+    if (s->state == SESSION_SEARCHING){
+        s->worker->engine->stop = true;
+    } else if (s->state == SESSION_QUEUED){
+        s->request.max_depth = 1;
+        s->request.limits = (TimeLimits){-1, 0, 0, 0};
+    }
+}
+
+// "position startpos|fen <fen> [moves <move>...]", the whole game is replayed
+static void set_session_position(Session* s, char* args){
+    char* moves = strstr(args, " moves");
+    if (moves != NULL){
+        *moves = 0;
+        moves += 6;
+    }
+    const char* fen;
+    if (strncmp(args, "startpos", 8) == 0){
+        fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+    } else if (strncmp(args, "fen ", 4) == 0){
+        fen = args + 4;
+    } else {
+        send_line(s, "info string invalid position command");
+        return;
+    }
+    uint64_t* board = from_FEN(fen);
+    if (__builtin_popcountll(board[WHITE_KING]) != 1 || __builtin_popcountll(board[BLACK_KING]) != 1){
+        send_line(s, "info string invalid position, each side needs one king");
+        free_board(board);
+        return;
+    }
+    int ply = ply_from_FEN(fen);
+    for (char* token = moves ? strtok(moves, " ") : NULL; token != NULL; token = strtok(NULL, " ")){
+        Move m;
+        if (!move_from_uci(token, board, &m)){
+            char line[64];
+            snprintf(line, sizeof(line), "info string illegal move %.16s", token);
+            send_line(s, line);
+            break;
+        }
+        apply_move(&m, board);
+        ply++;
+    }
+    memcpy(s->board, board, sizeof(s->board));
+    s->ply = ply;
+    free_board(board);
+}
+
+// "go ...", queues the search. the time controls of the side to move are used
+static void queue_search(Session* s, char* args){
+    SearchRequest* request = &s->request;
+    memcpy(request->board, s->board, sizeof(request->board));
+    request->ply = s->ply;
+    request->max_depth = MAX_SEARCH_DEPTH;
+    request->limits = (TimeLimits){-1, 0, 0, 0};
+    bool white = s->board[INFO] & TURN_BIT;
+    for (char* token = strtok(args, " "); token != NULL; token = strtok(NULL, " ")){
+        char* value = strtok(NULL, " ");
+        if (value == NULL) break;
+        if (strcmp(token, "depth") == 0){
+            request->max_depth = max(min(atoi(value), MAX_SEARCH_DEPTH), 1);
+        } else if (strcmp(token, "movetime") == 0){
+            request->limits.movetime = atol(value);
+        } else if (strcmp(token, white ? "wtime" : "btime") == 0){
+            request->limits.time_left = atol(value);
+        } else if (strcmp(token, white ? "winc" : "binc") == 0){
+            request->limits.increment = atol(value);
+        } else if (strcmp(token, "movestogo") == 0){
+            request->limits.moves_to_go = atoi(value);
+        }
+    }
+    if (request->max_depth == MAX_SEARCH_DEPTH && request->limits.time_left < 0 && request->limits.movetime == 0){
+        request->limits.movetime = SERVER_DEFAULT_MOVETIME;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &request->queued);
+
+    pthread_mutex_lock(&server_lock);
+    s->state = SESSION_QUEUED;
+    queue[queue_length++] = s;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&server_lock);
+}
+
+// returns false when the session ends
+static bool session_command(Session* s, char* line){
+    pthread_mutex_lock(&server_lock);
+    enum SESSION_STATE state = s->state;
+    pthread_mutex_unlock(&server_lock);
+
+    if (strcmp(line, "isready") == 0){
+        send_line(s, "readyok");
+    } else if (strcmp(line, "stop") == 0){
+        pthread_mutex_lock(&server_lock);
+        stop_session(s);
+        pthread_mutex_unlock(&server_lock);
+    } else if (strcmp(line, "quit") == 0){
+        return false;
+    } else if (state != SESSION_IDLE && (strncmp(line, "go", 2) == 0 || strncmp(line, "position ", 9) == 0 || strcmp(line, "ucinewgame") == 0)){
+        send_line(s, "info string busy, send stop and wait for bestmove first");
+    } else if (strcmp(line, "ucinewgame") == 0){
+        char startpos[] = "startpos";
+        set_session_position(s, startpos);
+    } else if (strncmp(line, "position ", 9) == 0){
+        set_session_position(s, line + 9);
+    } else if (strncmp(line, "go", 2) == 0 && (line[2] == 0 || line[2] == ' ')){
+        queue_search(s, line + 2);
+    } else if (line[0] != 0){
+        char reply[128];
+        snprintf(reply, sizeof(reply), "info string unknown command %.64s", line);
+        send_line(s, reply);
+    }
+    return true;
+}
+
+static Session* open_session(int fd){
+    Session* s = calloc(1, sizeof(Session));
+    if (s == NULL) return NULL;
+    s->fd = fd;
+    s->state = SESSION_IDLE;
+    pthread_mutex_init(&s->write_lock, NULL);
+    uint64_t* board = from_FEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+    memcpy(s->board, board, sizeof(s->board));
+    free_board(board);
+    return s;
+}
+
+// the client has gone, a search of the session is stopped and the worker frees the session when it is done with it
+static void close_session(int index){
+    Session* s = sessions[index];
+    memmove(sessions + index, sessions + index + 1, (num_sessions - index - 1) * sizeof(Session*));
+    num_sessions--;
+
+    pthread_mutex_lock(&server_lock);
+    for (int i = 0; i < queue_length; i++){
+        if (queue[i] == s){
+            memmove(queue + i, queue + i + 1, (queue_length - i - 1) * sizeof(Session*));
+            queue_length--;
+            s->state = SESSION_IDLE;
+            break;
+        }
+    }
+    stop_session(s);
+    s->closed = true;
+    bool in_use = s->users > 0;
+    pthread_mutex_unlock(&server_lock);
+    if (!in_use){
+        free_session(s);
+    }
+}
+
+// reads what the client sent and runs its complete lines, returns false once the session has ended
+static bool read_session(Session* s){
+    ssize_t n = recv(s->fd, s->buffer + s->buffered, sizeof(s->buffer) - s->buffered, 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) return true;
+    if (n <= 0) return false;
+    s->buffered += n;
+
+    char* start = s->buffer;
+    char* end;
+    while ((end = memchr(start, '\n', s->buffered - (start - s->buffer))) != NULL){
+        *end = 0;
+        if (end > start && end[-1] == '\r') end[-1] = 0;
+        if (!session_command(s, start)) return false;
+        start = end + 1;
+    }
+    s->buffered -= start - s->buffer;
+    memmove(s->buffer, start, s->buffered);
+    if (s->buffered == sizeof(s->buffer)){
+        send_line(s, "info string line too long");
+        return false;
+    }
+    return true;
+}
+
+// wakes the first started workers to exit, waits for them and frees every engine created so far
+static void stop_workers(int started){
+    if (workers == NULL) return;
+    pthread_mutex_lock(&server_lock);
+    shutting_down = true;
+    pthread_cond_broadcast(&queue_ready);
+    pthread_mutex_unlock(&server_lock);
+    for (int t = 0; t < started; t++){
+        pthread_join(workers[t].thread, NULL);
+    }
+    for (int t = 0; t < num_workers; t++){
+        free_engine(workers[t].engine);
+    }
+    free(workers);
+    workers = NULL;
+}
+
+/**
+ * Serves games on a Unix domain socket until the listening socket fails. Every connection is a session with its own position, see
+ * the GAME SERVER comment for the protocol.
+ * @param socket_path The socket to create, an existing file at the path is replaced.
+ * @param workers_wanted Searches run at once, 0 for one per core.
+ * @param max_movetime The longest a single search may take in ms, 0 for SERVER_MAX_MOVETIME.
+ * @param table Every worker's transposition table, a shared one is shared by the workers as well.
+ * @return 0 after a clean shutdown, 1 if the server could not start.
+ */
+int run_server(const char* socket_path, int workers_wanted, long max_movetime, const TableOptions* table){
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)){
+        printf("Socket path too long\n");
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0){
+        printf("Error opening socket %s\n", socket_path);
+        if (listener >= 0) close(listener);
+        return 1;
+    }
+
+    num_workers = workers_wanted > 0 ? workers_wanted : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers < 1) num_workers = 1;
+    server_max_movetime = max_movetime > 0 ? max_movetime : SERVER_MAX_MOVETIME;
+    workers = calloc(num_workers, sizeof(Worker));
+    int started = 0;
+    bool allocated = workers != NULL;
+    while (allocated && started < num_workers){
+        Worker* w = &workers[started];
+        w->engine = create_engine();
+        allocated = w->engine != NULL && open_trans_table(&w->engine->tt, table);
+        if (allocated){
+            pthread_create(&w->thread, NULL, server_worker, w);
+            started++;
+        }
+    }
+    if (!allocated){
+        printf("Error allocating engine\n");
+        stop_workers(started);
+        close(listener);
+        unlink(socket_path);
+        return 1;
+    }
+    printf("Serving on %s with %d workers\n", socket_path, num_workers);
+    fflush(stdout);
+
+    struct pollfd fds[SERVER_MAX_SESSIONS + 1];
+    while (true){
+        fds[0] = (struct pollfd){listener, POLLIN, 0};
+        for (int i = 0; i < num_sessions; i++){
+            fds[i + 1] = (struct pollfd){sessions[i]->fd, POLLIN, 0};
+        }
+        int polled = num_sessions;
+        if (poll(fds, polled + 1, -1) < 0){
+            if (errno == EINTR) continue;
+            break;
+        }
+        // sessions are closed from the back so the indices of the ones still to check stay valid
+        for (int i = polled - 1; i >= 0; i--){
+            if (fds[i + 1].revents && !read_session(sessions[i])){
+                close_session(i);
+            }
+        }
+        if (fds[0].revents & POLLIN){
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0) continue;
+            Session* s = num_sessions < SERVER_MAX_SESSIONS ? open_session(fd) : NULL;
+            if (s == NULL){
+                send(fd, "info string server full\n", 24, MSG_NOSIGNAL);
+                close(fd);
+                continue;
+            }
+            // a client that stops reading cannot hold up the workers for long
+            struct timeval timeout = {SERVER_SEND_TIMEOUT, 0};
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            sessions[num_sessions++] = s;
+        }
+    }
+
+    while (num_sessions > 0) close_session(num_sessions - 1);
+    stop_workers(num_workers);
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
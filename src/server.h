@@ -0,0 +1,10 @@
+#pragma once
+#include "hash_table.h"
+
+#define SERVER_MAX_SESSIONS 1024
+#define SERVER_LINE_LENGTH 8192 // position commands of long games carry every move
+#define SERVER_DEFAULT_MOVETIME 500 // ms per move when go gives no limits
+#define SERVER_MAX_MOVETIME 60000 // no search holds a worker longer than this
+#define SERVER_SEND_TIMEOUT 5 // s a reply may wait for a client that does not read
+
+int run_server(const char* socket_path, int num_workers, long max_movetime, const TableOptions* table);
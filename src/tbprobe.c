@@ -0,0 +1,970 @@
+#include "tbprobe.h"
+#include "constants.h"
+#include "helpers.h"
+#include "get_moves.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// SYZYGY TABLEBASES
+// probes the syzygy endgame tablebases: WDL (win/draw/loss) tables in search and DTZ (distance to zeroing move) tables at the root.
+// available tables are found when the directory is configured, but each file is only memory mapped the first time a position needs it,
+// so a large tablebase directory costs nothing until the engine reaches those endgames.
+// the decoding follows the syzygy file format: every table is split by side to move and, with pawns, by the file of the leading pawn,
+// positions are mapped to an index by exploiting board symmetries and the values are stored huffman coded after recursive pairing.
+//
+// squares here use the tablebase numbering, a1 = 0, b1 = 1, ..., h8 = 63, which is the board's bit index with the file mirrored (sq ^ 7).
+// pieces use the tablebase codes, pawn = 1 ... king = 6, plus 8 for black
+
+#define TB_HASH_SIZE 8192 // power of 2, room for both keys of every 7 piece table
+#define TB_MAX_PATHS 8
+#define TB_PATH_LENGTH 1024
+#define TB_MAX_DTZ 0x40000
+
+enum TB_TYPE { WDL, DTZ };
+
+// flags of each table part
+enum TB_FLAG {
+    TB_FLAG_STM = 1,
+    TB_FLAG_MAPPED = 2,
+    TB_FLAG_WIN_PLIES = 4,
+    TB_FLAG_LOSS_PLIES = 8,
+    TB_FLAG_WIDE = 16,
+    TB_FLAG_SINGLE_VALUE = 128
+};
+
+// outcome of a probe, beyond the value itself
+enum PROBE_STATE {
+    PROBE_FAIL = 0,
+    PROBE_OK = 1,
+    PROBE_CHANGE_STM = -1,   // DTZ table only stores the other side to move
+    PROBE_ZEROING_BEST = 2   // best move zeroes the 50 move counter
+};
+
+// decoding state of one part of a table (side to move, leading pawn file)
+typedef struct PairsData {
+    uint8_t flags;
+    uint8_t max_sym_len;
+    uint8_t min_sym_len;
+    uint32_t num_blocks;
+    size_t block_size;
+    size_t span;                  // values between sparse index entries
+    const uint8_t* lowest_sym;    // little endian 16 bit, lowest symbol of each code length
+    const uint8_t* btree;         // 3 bytes per symbol, the 12 bit left and right symbols it expands to
+    const uint8_t* block_length;  // little endian 16 bit, values stored in each block minus one
+    uint32_t block_length_size;
+    const uint8_t* sparse_index;  // 6 bytes per entry, 32 bit block and 16 bit offset
+    size_t sparse_index_size;
+    const uint8_t* data;
+    uint64_t base64[33];          // lowest code of each length, left aligned in 64 bits
+    uint8_t* symlen;              // values represented by each symbol minus one
+    int num_syms;
+    uint8_t pieces[TB_PIECES];
+    uint64_t group_idx[TB_PIECES + 1];
+    int group_len[TB_PIECES + 1];
+    uint16_t map_idx[4];          // DTZ value maps for win, loss, cursed win and blessed loss
+} PairsData;
+
+typedef struct TBTable {
+    uint64_t key;   // material key with the stronger side white
+    uint64_t key2;  // and with the stronger side black
+    char name[16];  // such as KRvK
+    int piece_count;
+    bool has_pawns;
+    bool has_unique_pieces;
+    int pawn_count[2]; // leading colour first
+    int ready[2];      // per TB_TYPE, 0 not mapped yet, 1 mapped, -1 missing or corrupt
+    uint8_t* base[2];
+    size_t mapped_size[2];
+    const uint8_t* dtz_map;
+    PairsData items[2][2][4]; // [TB_TYPE][side to move][leading pawn file]
+} TBTable;
+
+typedef struct TBHashEntry {
+    uint64_t key;
+    TBTable* table;
+} TBHashEntry;
+
+int SyzygyProbeDepth = TB_DEFAULT_PROBE_DEPTH;
+int SyzygyProbeLimit = TB_DEFAULT_PROBE_LIMIT;
+
+static TBHashEntry tb_hash[TB_HASH_SIZE];
+static char tb_paths[TB_MAX_PATHS][TB_PATH_LENGTH];
+static int tb_num_paths = 0;
+static int tb_largest = 0;
+static pthread_mutex_t tb_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// INDEXING CONSTANTS
+// filled in once by init_tb_constants
+
+static int Binomial[7][64];           // Binomial[k][n], ways to choose k of n
+static int MapB1H1H7[64];             // squares below the a1-h8 diagonal to 0..27
+static int MapA1D1D4[64];             // the a1-d1-d4 triangle to 0..9, diagonal squares last
+static int MapKK[10][64];             // the 462 legal king pairs with the first king in the triangle
+static int MapPawns[64];              // pawn squares to 0..47, the highest is the leading pawn
+static int LeadPawnIdx[6][64];        // start index of each leading pawn square
+static int LeadPawnsSize[6][4];       // number of leading pawn placements per file
+
+static inline int file_of(int sq){ return sq & 7; }
+static inline int rank_of(int sq){ return sq >> 3; }
+static inline int off_A1H8(int sq){ return rank_of(sq) - file_of(sq); }
+static inline int sign_of(int x){ return (x > 0) - (x < 0); }
+
+static inline uint16_t read_le16(const uint8_t* p){ return (uint16_t)(p[0] | (p[1] << 8)); }
+static inline uint32_t read_le32(const uint8_t* p){ return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline uint32_t read_be32(const uint8_t* p){ return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]; }
+static inline uint64_t read_be64(const uint8_t* p){ return ((uint64_t)read_be32(p) << 32) | read_be32(p + 4); }
+
+static inline int btree_left(const PairsData* d, int sym){
+    const uint8_t* lr = d->btree + 3 * sym;
+    return ((lr[1] & 0xF) << 8) | lr[0];
+}
+
+static inline int btree_right(const PairsData* d, int sym){
+    const uint8_t* lr = d->btree + 3 * sym;
+    return (lr[2] << 4) | (lr[1] >> 4);
+}
+
+static void init_tb_constants(){
+    static bool done = false;
+    if (done) return;
+    done = true;
+
+    Binomial[0][0] = 1;
+    for (int n = 1; n < 64; n++){
+        for (int k = 0; k < 7 && k <= n; k++){
+            Binomial[k][n] = (k > 0 ? Binomial[k - 1][n - 1] : 0) + (k < n ? Binomial[k][n - 1] : 0);
+        }
+    }
+
+    int code = 0;
+    for (int sq = 0; sq < 64; sq++){
+        if (off_A1H8(sq) < 0) MapB1H1H7[sq] = code++;
+    }
+
+    // a1, b1, c1, d1, b2, c2, d2, c3, d3, d4, off diagonal squares first
+    static const int TRIANGLE[10] = {0, 1, 2, 3, 9, 10, 11, 18, 19, 27};
+    int diagonal[4], num_diagonal = 0;
+    code = 0;
+    for (int i = 0; i < 10; i++){
+        if (off_A1H8(TRIANGLE[i]) < 0) MapA1D1D4[TRIANGLE[i]] = code++;
+        else diagonal[num_diagonal++] = TRIANGLE[i];
+    }
+    for (int i = 0; i < num_diagonal; i++){
+        MapA1D1D4[diagonal[i]] = code++;
+    }
+
+    // king pairs with both kings on the diagonal come last
+    int both_on_diagonal[64][2], num_both = 0;
+    code = 0;
+    for (int idx = 0; idx < 10; idx++){
+        for (int s1 = 0; s1 <= 27; s1++){
+            if (MapA1D1D4[s1] != idx || (!idx && s1 != 1)) continue; // b1 is the only square mapped to 0
+            for (int s2 = 0; s2 < 64; s2++){
+                if (abs(file_of(s1) - file_of(s2)) <= 1 && abs(rank_of(s1) - rank_of(s2)) <= 1) continue; // touching kings
+                if (!off_A1H8(s1) && off_A1H8(s2) > 0) continue; // first on the diagonal, second above it
+                if (!off_A1H8(s1) && !off_A1H8(s2)){
+                    both_on_diagonal[num_both][0] = idx;
+                    both_on_diagonal[num_both++][1] = s2;
+                } else {
+                    MapKK[idx][s2] = code++;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < num_both; i++){
+        MapKK[both_on_diagonal[i][0]][both_on_diagonal[i][1]] = code++;
+    }
+
+    // pawns toward the edge and on lower ranks get higher values, on a2 a pawn leaves 47 squares for the others
+    int available = 47;
+    for (int lead_pawns = 1; lead_pawns <= 5; lead_pawns++){
+        for (int f = 0; f < 4; f++){
+            int idx = 0;
+            for (int r = 1; r <= 6; r++){
+                int sq = (r << 3) | f;
+                if (lead_pawns == 1){
+                    MapPawns[sq] = available--;
+                    MapPawns[sq ^ 7] = available--;
+                }
+                LeadPawnIdx[lead_pawns][sq] = idx;
+                idx += Binomial[lead_pawns - 1][MapPawns[sq]];
+            }
+            LeadPawnsSize[lead_pawns][f] = idx;
+        }
+    }
+}
+
+// TABLE REGISTRY
+
+static TBHashEntry* hash_slot(uint64_t key){
+    int idx = (int)((key * 0x9E3779B97F4A7C15ULL) >> 51) & (TB_HASH_SIZE - 1);
+    while (tb_hash[idx].key != 0 && tb_hash[idx].key != key){
+        idx = (idx + 1) & (TB_HASH_SIZE - 1);
+    }
+    return &tb_hash[idx];
+}
+
+static TBTable* find_table(uint64_t key){
+    TBHashEntry* slot = hash_slot(key);
+    return slot->key == key ? slot->table : NULL;
+}
+
+// parses a table name such as KRPvKR, pieces before the v are white's. returns false for anything else in the directory
+static bool parse_table_name(const char* name, int counts[12]){
+    static const char LETTERS[] = "PNBRQK";
+    memset(counts, 0, 12 * sizeof(int));
+    int side = WHITE_PAWN;
+    int total = 0;
+    for (const char* p = name; *p; p++){
+        if (*p == 'v' && side == WHITE_PAWN){
+            side = BLACK_PAWN;
+            continue;
+        }
+        const char* letter = strchr(LETTERS, *p);
+        if (letter == NULL) return false;
+        counts[side + (int)(letter - LETTERS)]++;
+        total++;
+    }
+    return side == BLACK_PAWN && counts[WHITE_KING] == 1 && counts[BLACK_KING] == 1 && total > 2 && total <= TB_PIECES;
+}
+
+static bool add_table(const char* name){
+    int counts[12];
+    if (!parse_table_name(name, counts)) return false;
+
+    uint64_t key = 0, key2 = 0;
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+        key += (uint64_t)counts[pc] << (pc << 2);
+        key2 += (uint64_t)counts[pc] << (((pc + BLACK_PAWN) % 12) << 2);
+    }
+    if (find_table(key) != NULL) return false; // same table in two directories
+
+    TBTable* table = calloc(1, sizeof(TBTable));
+    snprintf(table->name, sizeof(table->name), "%s", name);
+    table->key = key;
+    table->key2 = key2;
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+        table->piece_count += counts[pc];
+        if (pc != WHITE_KING && pc != BLACK_KING && counts[pc] == 1) table->has_unique_pieces = true;
+    }
+    table->has_pawns = counts[WHITE_PAWN] || counts[BLACK_PAWN];
+
+    // the leading colour is the side with fewer pawns, which compresses better
+    bool white_leads = !counts[BLACK_PAWN] || (counts[WHITE_PAWN] && counts[BLACK_PAWN] >= counts[WHITE_PAWN]);
+    table->pawn_count[0] = white_leads ? counts[WHITE_PAWN] : counts[BLACK_PAWN];
+    table->pawn_count[1] = white_leads ? counts[BLACK_PAWN] : counts[WHITE_PAWN];
+
+    hash_slot(key)->table = table;
+    hash_slot(key)->key = key;
+    hash_slot(key2)->table = table;
+    hash_slot(key2)->key = key2;
+    tb_largest = max(tb_largest, table->piece_count);
+    return true;
+}
+
+// TABLE INITIALIZATION
+// runs when a file is first mapped, points the PairsData of each table part into the file
+
+static uint8_t set_symlen(PairsData* d, int sym, bool* visited){
+    visited[sym] = true;
+    int right = btree_right(d, sym);
+    if (right == 0xFFF) return 0;
+    int left = btree_left(d, sym);
+    if (!visited[left]) d->symlen[left] = set_symlen(d, left, visited);
+    if (!visited[right]) d->symlen[right] = set_symlen(d, right, visited);
+    return d->symlen[left] + d->symlen[right] + 1;
+}
+
+static const uint8_t* set_sizes(PairsData* d, const uint8_t* data){
+    d->flags = *data++;
+    if (d->flags & TB_FLAG_SINGLE_VALUE){
+        d->num_blocks = d->block_length_size = 0;
+        d->span = d->sparse_index_size = 0;
+        d->min_sym_len = *data++; // the single value
+        return data;
+    }
+
+    // the last group index is the size of the table
+    int groups = 0;
+    while (d->group_len[groups]) groups++;
+    uint64_t tb_size = d->group_idx[groups];
+
+    d->block_size = (size_t)1 << *data++;
+    d->span = (size_t)1 << *data++;
+    d->sparse_index_size = (size_t)((tb_size + d->span - 1) / d->span);
+    int padding = *data++;
+    d->num_blocks = read_le32(data);
+    data += 4;
+    d->block_length_size = d->num_blocks + padding; // padded so the sparse index never points past the end
+    d->max_sym_len = *data++;
+    d->min_sym_len = *data++;
+    d->lowest_sym = data;
+
+    // canonical huffman code: longer codes have lower values, so base64 (left aligned lowest code of each length) is decreasing
+    int lengths = d->max_sym_len - d->min_sym_len + 1;
+    d->base64[lengths - 1] = 0;
+    for (int i = lengths - 2; i >= 0; i--){
+        d->base64[i] = (d->base64[i + 1] + read_le16(d->lowest_sym + 2 * i) - read_le16(d->lowest_sym + 2 * (i + 1))) / 2;
+    }
+    for (int i = 0; i < lengths; i++){
+        d->base64[i] <<= 64 - i - d->min_sym_len;
+    }
+    data += lengths * 2;
+
+    d->num_syms = read_le16(data);
+    data += 2;
+    d->btree = data;
+    d->symlen = calloc(d->num_syms, 1);
+    bool* visited = calloc(d->num_syms, sizeof(bool));
+    for (int sym = 0; sym < d->num_syms; sym++){
+        if (!visited[sym]) d->symlen[sym] = set_symlen(d, sym, visited);
+    }
+    free(visited);
+    return data + d->num_syms * 3 + (d->num_syms & 1);
+}
+
+// groups of pieces are encoded together, such as both kings and the rook in KRvK. order gives the position of the leading group and the remaining pawns
+static void set_groups(const TBTable* e, PairsData* d, const int order[2], int f){
+    int n = 0;
+    int first_len = e->has_pawns ? 0 : e->has_unique_pieces ? 3 : 2;
+    d->group_len[n] = 1;
+    for (int i = 1; i < e->piece_count; i++){
+        if (--first_len > 0 || d->pieces[i] == d->pieces[i - 1]){
+            d->group_len[n]++;
+        } else {
+            d->group_len[++n] = 1;
+        }
+    }
+    d->group_len[++n] = 0;
+
+    bool pp = e->has_pawns && e->pawn_count[1]; // pawns on both sides
+    int next = pp ? 2 : 1;
+    int free_squares = 64 - d->group_len[0] - (pp ? d->group_len[1] : 0);
+    uint64_t idx = 1;
+
+    for (int k = 0; next < n || k == order[0] || k == order[1]; k++){
+        if (k == order[0]){ // leading pawns or pieces
+            d->group_idx[0] = idx;
+            idx *= e->has_pawns ? LeadPawnsSize[d->group_len[0]][f] : e->has_unique_pieces ? 31332 : 462;
+        } else if (k == order[1]){ // remaining pawns
+            d->group_idx[1] = idx;
+            idx *= Binomial[d->group_len[1]][48 - d->group_len[0]];
+        } else { // remaining pieces
+            d->group_idx[next] = idx;
+            idx *= Binomial[d->group_len[next]][free_squares];
+            free_squares -= d->group_len[next++];
+        }
+    }
+    d->group_idx[n] = idx;
+}
+
+static const uint8_t* set_dtz_map(TBTable* e, const uint8_t* data, int max_file){
+    e->dtz_map = data;
+    for (int f = 0; f <= max_file; f++){
+        PairsData* d = &e->items[DTZ][0][f];
+        if (!(d->flags & TB_FLAG_MAPPED)) continue;
+        if (d->flags & TB_FLAG_WIDE){
+            data += (uintptr_t)data & 1;
+            for (int i = 0; i < 4; i++){
+                d->map_idx[i] = (uint16_t)((data - e->dtz_map) / 2 + 1);
+                data += 2 * read_le16(data) + 2;
+            }
+        } else {
+            for (int i = 0; i < 4; i++){
+                d->map_idx[i] = (uint16_t)(data - e->dtz_map + 1);
+                data += *data + 1;
+            }
+        }
+    }
+    return data + ((uintptr_t)data & 1);
+}
+
+static void init_table(TBTable* e, int type, const uint8_t* data){
+    data++; // flags, split and has pawns, already known from the name
+
+    int sides = type == WDL && e->key != e->key2 ? 2 : 1;
+    int max_file = e->has_pawns ? 3 : 0;
+    bool pp = e->has_pawns && e->pawn_count[1];
+
+    for (int f = 0; f <= max_file; f++){
+        int order[2][2] = {{*data & 0xF, pp ? *(data + 1) & 0xF : 0xF},
+                           {*data >> 4, pp ? *(data + 1) >> 4 : 0xF}};
+        data += 1 + pp;
+        for (int k = 0; k < e->piece_count; k++, data++){
+            for (int i = 0; i < sides; i++){
+                e->items[type][i][f].pieces[k] = i ? *data >> 4 : *data & 0xF;
+            }
+        }
+        for (int i = 0; i < sides; i++){
+            set_groups(e, &e->items[type][i][f], order[i], f);
+        }
+    }
+    data += (uintptr_t)data & 1;
+
+    for (int f = 0; f <= max_file; f++){
+        for (int i = 0; i < sides; i++){
+            data = set_sizes(&e->items[type][i][f], data);
+        }
+    }
+    if (type == DTZ){
+        data = set_dtz_map(e, data, max_file);
+    }
+    for (int f = 0; f <= max_file; f++){
+        for (int i = 0; i < sides; i++){
+            e->items[type][i][f].sparse_index = data;
+            data += e->items[type][i][f].sparse_index_size * 6;
+        }
+    }
+    for (int f = 0; f <= max_file; f++){
+        for (int i = 0; i < sides; i++){
+            e->items[type][i][f].block_length = data;
+            data += e->items[type][i][f].block_length_size * 2;
+        }
+    }
+    for (int f = 0; f <= max_file; f++){
+        for (int i = 0; i < sides; i++){
+            data = (const uint8_t*)(((uintptr_t)data + 0x3F) & ~(uintptr_t)0x3F);
+            e->items[type][i][f].data = data;
+            data += (size_t)e->items[type][i][f].num_blocks * e->items[type][i][f].block_size;
+        }
+    }
+}
+
+static bool map_file(TBTable* e, int type){
+    static const uint8_t MAGIC[2][4] = {{0x71, 0xE8, 0x23, 0x5D}, {0xD7, 0x66, 0x0C, 0xA5}};
+    char filename[TB_PATH_LENGTH + sizeof(e->name) + sizeof(".rtbw")];
+    for (int i = 0; i < tb_num_paths; i++){
+        int length = snprintf(filename, sizeof(filename), "%s/%s%s", tb_paths[i], e->name, type == WDL ? ".rtbw" : ".rtbz");
+        if (length < 0 || (size_t)length >= sizeof(filename)) continue;
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) continue;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size % 64 != 16){
+            printf("Corrupted tablebase file %s\n", filename);
+            close(fd);
+            return false;
+        }
+        uint8_t* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED){
+            printf("Error mapping file %s\n", filename);
+            return false;
+        }
+        if (memcmp(base, MAGIC[type], 4) != 0){
+            printf("Corrupted tablebase file %s\n", filename);
+            munmap(base, st.st_size);
+            return false;
+        }
+        madvise(base, st.st_size, MADV_RANDOM);
+        e->base[type] = base;
+        e->mapped_size[type] = st.st_size;
+        init_table(e, type, base + 4);
+        return true;
+    }
+    return false;
+}
+
+// maps the file of a table the first time it is needed, safe to call from several search threads
+static bool map_table(TBTable* e, int type){
+    int ready = __atomic_load_n(&e->ready[type], __ATOMIC_ACQUIRE);
+    if (ready) return ready > 0;
+
+    pthread_mutex_lock(&tb_mutex);
+    if (!e->ready[type]){
+        __atomic_store_n(&e->ready[type], map_file(e, type) ? 1 : -1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&tb_mutex);
+    return e->ready[type] > 0;
+}
+
+// DECODING
+
+// value at index idx of one table part
+static int decompress_pairs(const PairsData* d, uint64_t idx){
+    if (d->flags & TB_FLAG_SINGLE_VALUE){
+        return d->min_sym_len;
+    }
+
+    // the sparse index entry k gives the block and offset of value k * span + span / 2, walk from there to the block holding idx
+    uint32_t k = (uint32_t)(idx / d->span);
+    uint32_t block = read_le32(d->sparse_index + 6 * k);
+    int offset = read_le16(d->sparse_index + 6 * k + 4);
+    offset += (int)(idx % d->span) - (int)(d->span / 2);
+
+    while (offset < 0){
+        offset += read_le16(d->block_length + 2 * (--block)) + 1;
+    }
+    while (offset > read_le16(d->block_length + 2 * block)){
+        offset -= read_le16(d->block_length + 2 * (block++)) + 1;
+    }
+
+    // read huffman symbols from the start of the block until the one covering offset
+    const uint8_t* ptr = d->data + (uint64_t)block * d->block_size;
+    uint64_t buf64 = read_be64(ptr);
+    ptr += 8;
+    int buf64_size = 64;
+    int sym;
+
+    while (true){
+        int len = 0; // code length minus min_sym_len
+        while (buf64 < d->base64[len]){
+            len++;
+        }
+        sym = (int)((buf64 - d->base64[len]) >> (64 - len - d->min_sym_len));
+        sym += read_le16(d->lowest_sym + 2 * len);
+
+        if (offset < d->symlen[sym] + 1) break;
+
+        offset -= d->symlen[sym] + 1;
+        len += d->min_sym_len;
+        buf64 <<= len;
+        buf64_size -= len;
+        if (buf64_size <= 32){
+            buf64_size += 32;
+            buf64 |= (uint64_t)read_be32(ptr) << (64 - buf64_size);
+            ptr += 4;
+        }
+    }
+
+    // expand the pair symbols down to the single value at offset
+    while (d->symlen[sym]){
+        int left = btree_left(d, sym);
+        if (offset < d->symlen[left] + 1){
+            sym = left;
+        } else {
+            offset -= d->symlen[left] + 1;
+            sym = btree_right(d, sym);
+        }
+    }
+    return btree_left(d, sym);
+}
+
+// DTZ tables store plies or moves, and sometimes remap values to fit in a byte
+static int map_dtz_score(const TBTable* e, int f, int value, int wdl){
+    static const int WDL_MAP[] = {1, 3, 0, 2, 0};
+    const PairsData* d = &e->items[DTZ][0][f];
+
+    if (d->flags & TB_FLAG_MAPPED){
+        if (d->flags & TB_FLAG_WIDE){
+            value = read_le16(e->dtz_map + 2 * (d->map_idx[WDL_MAP[wdl + 2]] + value));
+        } else {
+            value = e->dtz_map[d->map_idx[WDL_MAP[wdl + 2]] + value];
+        }
+    }
+    if ((wdl == TB_WIN && !(d->flags & TB_FLAG_WIN_PLIES)) || (wdl == TB_LOSS && !(d->flags & TB_FLAG_LOSS_PLIES)) || wdl == TB_CURSED_WIN || wdl == TB_BLESSED_LOSS){
+        value *= 2;
+    }
+    return value + 1;
+}
+
+static inline int tb_piece_code(int pc){
+    return pc < BLACK_PAWN ? pc + 1 : pc - BLACK_PAWN + 9;
+}
+
+static void sort_squares(int* squares, int n, bool by_map_pawns){
+    for (int i = 1; i < n; i++){
+        int sq = squares[i];
+        int j = i - 1;
+        while (j >= 0 && (by_map_pawns ? MapPawns[squares[j]] > MapPawns[sq] : squares[j] > sq)){
+            squares[j + 1] = squares[j];
+            j--;
+        }
+        squares[j + 1] = sq;
+    }
+}
+
+// encodes the position as an index into the table and decodes the stored value
+static int probe_table(TBTable* e, int type, const uint64_t* board, int wdl, int* state){
+    int squares[TB_PIECES], pieces[TB_PIECES];
+    int size = 0, lead_pawns_cnt = 0, tb_file = 0;
+    uint64_t lead_pawns = 0, idx;
+
+    // tables are stored with white as the stronger side, and symmetric ones only with white to move, otherwise swap colours and flip the board
+    bool black_to_move = !(board[INFO] & TURN_BIT);
+    bool flip = (e->key == e->key2 && black_to_move) || board[MATERIAL] != e->key;
+    int flip_color = flip ? 8 : 0;
+    int flip_squares = flip ? 56 : 0;
+    int stm = flip ^ black_to_move;
+
+    // with pawns, the table is split by the file of the leading pawn
+    if (e->has_pawns){
+        int pc = e->items[type][0][0].pieces[0] ^ flip_color;
+        lead_pawns = board[(pc & 8) ? BLACK_PAWN : WHITE_PAWN];
+        for (uint64_t b = lead_pawns; b; b &= b - 1){
+            squares[size++] = (__builtin_ctzll(b) ^ 7) ^ flip_squares;
+        }
+        lead_pawns_cnt = size;
+        int lead = 0;
+        for (int i = 1; i < lead_pawns_cnt; i++){
+            if (MapPawns[squares[i]] > MapPawns[squares[lead]]) lead = i;
+        }
+        int tmp = squares[0];
+        squares[0] = squares[lead];
+        squares[lead] = tmp;
+        tb_file = min(file_of(squares[0]), 7 - file_of(squares[0]));
+    }
+
+    // DTZ tables are one sided
+    if (type == DTZ){
+        const PairsData* d = &e->items[DTZ][0][tb_file];
+        if ((d->flags & TB_FLAG_STM) != stm && !(e->key == e->key2 && !e->has_pawns)){
+            *state = PROBE_CHANGE_STM;
+            return 0;
+        }
+    }
+
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+        for (uint64_t b = board[pc] & ~lead_pawns; b; b &= b - 1){
+            squares[size] = (__builtin_ctzll(b) ^ 7) ^ flip_squares;
+            pieces[size++] = tb_piece_code(pc) ^ flip_color;
+        }
+    }
+
+    const PairsData* d = &e->items[type][type == WDL ? stm : 0][tb_file];
+
+    // reorder the pieces to the sequence of the table
+    for (int i = lead_pawns_cnt; i < size - 1; i++){
+        for (int j = i + 1; j < size; j++){
+            if (d->pieces[i] == pieces[j]){
+                int tmp = pieces[i]; pieces[i] = pieces[j]; pieces[j] = tmp;
+                tmp = squares[i]; squares[i] = squares[j]; squares[j] = tmp;
+                break;
+            }
+        }
+    }
+
+    // mirror so the leading piece is on the a-d files
+    if (file_of(squares[0]) > 3){
+        for (int i = 0; i < size; i++) squares[i] ^= 7;
+    }
+
+    if (e->has_pawns){
+        idx = LeadPawnIdx[lead_pawns_cnt][squares[0]];
+        sort_squares(squares + 1, lead_pawns_cnt - 1, true);
+        for (int i = 1; i < lead_pawns_cnt; i++){
+            idx += Binomial[i][MapPawns[squares[i]]];
+        }
+    } else {
+        // without pawns, also mirror the leading piece to the lower half and below the a1-h8 diagonal
+        if (rank_of(squares[0]) > 3){
+            for (int i = 0; i < size; i++) squares[i] ^= 56;
+        }
+        for (int i = 0; i < d->group_len[0]; i++){
+            if (!off_A1H8(squares[i])) continue;
+            if (off_A1H8(squares[i]) > 0){
+                for (int j = i; j < size; j++){
+                    squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+                }
+            }
+            break;
+        }
+
+        if (e->has_unique_pieces){
+            // three unique pieces, kings included, are encoded together
+            int adjust1 = squares[1] > squares[0];
+            int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+            if (off_A1H8(squares[0])){
+                idx = (uint64_t)(MapA1D1D4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 + squares[2] - adjust2;
+            } else if (off_A1H8(squares[1])){
+                idx = (uint64_t)(6 * 63 + rank_of(squares[0]) * 28 + MapB1H1H7[squares[1]]) * 62 + squares[2] - adjust2;
+            } else if (off_A1H8(squares[2])){
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + rank_of(squares[0]) * 7 * 28 + (rank_of(squares[1]) - adjust1) * 28 + MapB1H1H7[squares[2]];
+            } else {
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + rank_of(squares[0]) * 7 * 6 + (rank_of(squares[1]) - adjust1) * 6 + (rank_of(squares[2]) - adjust2);
+            }
+        } else {
+            idx = MapKK[MapA1D1D4[squares[0]]][squares[1]];
+        }
+    }
+
+    // remaining groups, squares counted down past the squares taken by earlier groups
+    idx *= d->group_idx[0];
+    int* group_sq = squares + d->group_len[0];
+    bool remaining_pawns = e->has_pawns && e->pawn_count[1];
+    for (int next = 1; d->group_len[next]; next++){
+        sort_squares(group_sq, d->group_len[next], false);
+        uint64_t n = 0;
+        for (int i = 0; i < d->group_len[next]; i++){
+            int adjust = 0;
+            for (int* s = squares; s < group_sq; s++){
+                adjust += group_sq[i] > *s;
+            }
+            n += Binomial[i + 1][group_sq[i] - adjust - 8 * remaining_pawns];
+        }
+        remaining_pawns = false;
+        idx += n * d->group_idx[next];
+        group_sq += d->group_len[next];
+    }
+
+    int value = decompress_pairs(d, idx);
+    return type == WDL ? value - 2 : map_dtz_score(e, tb_file, value, wdl);
+}
+
+static int probe(uint64_t* board, int type, int wdl, int* state){
+    if (__builtin_popcountll(board[WHITE_PCS] | board[BLACK_PCS]) == 2){
+        return TB_DRAW;
+    }
+    TBTable* e = find_table(board[MATERIAL]);
+    if (e == NULL || !map_table(e, type)){
+        *state = PROBE_FAIL;
+        return 0;
+    }
+    return probe_table(e, type, board, wdl, state);
+}
+
+// SEARCH LEVEL PROBES
+
+static inline bool is_capture(const Move* m){
+    return m->type == CAPTURE_PROMOTE || (m->type == CAPTURE && (m->pc1 < BLACK_PAWN) != (m->pc2 < BLACK_PAWN)); // castling is a capture of the own rook
+}
+
+static inline bool is_zeroing(const Move* m){
+    return is_capture(m) || m->pc1 == WHITE_PAWN || m->pc1 == BLACK_PAWN;
+}
+
+static inline bool in_check(const uint64_t* board){
+    return (board[INFO] & TURN_BIT) ? (board[WHITE_KING] & get_black_attackers(board)) != 0 : (board[BLACK_KING] & get_white_attackers(board)) != 0;
+}
+
+static int dtz_before_zeroing(int wdl){
+    return wdl == TB_WIN ? 1 : wdl == TB_CURSED_WIN ? 101 : wdl == TB_BLESSED_LOSS ? -101 : wdl == TB_LOSS ? -1 : 0;
+}
+
+// tables hold no en passant positions and their values may be wrong where the best move is a capture, so captures
+// (and pawn moves, for DTZ) are searched first and the table is only trusted if it does not beat them
+static int probe_search(uint64_t* board, int* state, bool check_zeroing){
+    Move movs[MOVES_ARRAY_LENGTH];
+    int total = get_legal_moves(movs, board);
+    int searched = 0;
+    int best = TB_LOSS, value;
+
+    for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+        if (!is_capture(movptr) && (!check_zeroing || (movptr->pc1 != WHITE_PAWN && movptr->pc1 != BLACK_PAWN))) continue;
+        searched++;
+        apply_move(movptr, board);
+        value = -probe_search(board, state, false);
+        apply_move(movptr, board);
+        if (*state == PROBE_FAIL) return TB_DRAW;
+        if (value > best){
+            best = value;
+            if (value >= TB_WIN){
+                *state = PROBE_ZEROING_BEST;
+                return value;
+            }
+        }
+    }
+
+    bool no_more_moves = searched && searched == total;
+    if (no_more_moves){
+        value = best;
+    } else {
+        value = probe(board, WDL, TB_DRAW, state);
+        if (*state == PROBE_FAIL) return TB_DRAW;
+    }
+
+    if (best >= value){
+        *state = best > TB_DRAW || no_more_moves ? PROBE_ZEROING_BEST : PROBE_OK;
+        return best;
+    }
+    *state = PROBE_OK;
+    return value;
+}
+
+static int probe_dtz(uint64_t* board, int* state){
+    *state = PROBE_OK;
+    int wdl = probe_search(board, state, true);
+    if (*state == PROBE_FAIL || wdl == TB_DRAW) return 0;
+    if (*state == PROBE_ZEROING_BEST) return dtz_before_zeroing(wdl);
+
+    int dtz = probe(board, DTZ, wdl, state);
+    if (*state == PROBE_FAIL) return 0;
+    if (*state != PROBE_CHANGE_STM){
+        return (dtz + 100 * (wdl == TB_BLESSED_LOSS || wdl == TB_CURSED_WIN)) * sign_of(wdl);
+    }
+
+    // the table stores the other side to move, search one ply for the move minimizing DTZ
+    Move movs[MOVES_ARRAY_LENGTH];
+    Move replies[MOVES_ARRAY_LENGTH];
+    int min_dtz = 0xFFFF;
+    get_legal_moves(movs, board);
+    for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+        bool zeroing = is_zeroing(movptr);
+        apply_move(movptr, board);
+        dtz = zeroing ? -dtz_before_zeroing(probe_search(board, state, false)) : -probe_dtz(board, state);
+        if (dtz == 1 && in_check(board) && get_legal_moves(replies, board) == 0){
+            min_dtz = 1; // mate
+        }
+        if (!zeroing){
+            dtz += sign_of(dtz);
+        }
+        if (dtz < min_dtz && sign_of(dtz) == sign_of(wdl)){
+            min_dtz = dtz;
+        }
+        apply_move(movptr, board);
+        if (*state == PROBE_FAIL) return 0;
+    }
+    return min_dtz == 0xFFFF ? -1 : min_dtz;
+}
+
+// INTERFACE
+
+/**
+ * Finds the syzygy tables in a directory. Files are only mapped once a position needs them.
+ * @param path Directory holding .rtbw and .rtbz files, several directories can be separated by ':'. NULL or "<empty>" disables probing.
+ * @return The number of WDL tables found.
+ */
+int tb_init(const char* path){
+    init_tb_constants();
+    tb_free();
+    if (path == NULL || *path == 0 || strcmp(path, "<empty>") == 0) return 0;
+
+    int found = 0;
+    const char* start = path;
+    while (*start && tb_num_paths < TB_MAX_PATHS){
+        size_t len = strcspn(start, ":");
+        snprintf(tb_paths[tb_num_paths], TB_PATH_LENGTH, "%.*s", (int)len, start);
+        start += len + (start[len] == ':');
+
+        DIR* dir = opendir(tb_paths[tb_num_paths]);
+        if (dir == NULL){
+            printf("Error opening directory %s\n", tb_paths[tb_num_paths]);
+            continue;
+        }
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL){
+            size_t name_len = strlen(entry->d_name);
+            if (name_len < 6 || name_len > 20 || strcmp(entry->d_name + name_len - 5, ".rtbw") != 0) continue;
+            char name[16];
+            snprintf(name, sizeof(name), "%.*s", (int)(name_len - 5), entry->d_name);
+            found += add_table(name);
+        }
+        closedir(dir);
+        tb_num_paths++;
+    }
+    return found;
+}
+
+/**
+ * Unmaps every tablebase file and forgets the found tables.
+ */
+void tb_free(){
+    pthread_mutex_lock(&tb_mutex);
+    for (int i = 0; i < TB_HASH_SIZE; i++){
+        TBTable* e = tb_hash[i].table;
+        if (e == NULL || tb_hash[i].key != e->key) continue; // each table is freed through its first key
+        for (int type = WDL; type <= DTZ; type++){
+            if (e->base[type]) munmap(e->base[type], e->mapped_size[type]);
+            for (int side = 0; side < 2; side++){
+                for (int f = 0; f < 4; f++){
+                    free(e->items[type][side][f].symlen);
+                }
+            }
+        }
+        free(e);
+    }
+    memset(tb_hash, 0, sizeof(tb_hash));
+    tb_num_paths = 0;
+    tb_largest = 0;
+    pthread_mutex_unlock(&tb_mutex);
+}
+
+/**
+ * @return The most pieces, kings included, that search will probe: the largest table found, capped by SyzygyProbeLimit.
+ */
+int tb_cardinality(){
+    return min(tb_largest, SyzygyProbeLimit);
+}
+
+/**
+ * @return Whether the position is small enough to be in the tables. Positions with castling rights never are.
+ */
+bool tb_can_probe(const uint64_t* board){
+    static const uint64_t CASTLING = WHITE_KINGSIDE_RIGHT | WHITE_QUEENSIDE_RIGHT | BLACK_KINGSIDE_RIGHT | BLACK_QUEENSIDE_RIGHT;
+    return __builtin_popcountll(board[WHITE_PCS] | board[BLACK_PCS]) <= tb_cardinality() && !(board[INFO] & CASTLING);
+}
+
+/**
+ * Probes the WDL tables. The result is exact for the 50 move rule only right after a capture or pawn move.
+ * @param board The position, unchanged on return.
+ * @param success Set to false if the table is missing or corrupt.
+ * @return The TB_WDL value for the side to move.
+ */
+int tb_probe_wdl(uint64_t* board, bool* success){
+    int state = PROBE_OK;
+    int wdl = probe_search(board, &state, false);
+    *success = state != PROBE_FAIL;
+    return wdl;
+}
+
+/**
+ * Probes the DTZ tables, assuming the 50 move counter is zero.
+ * @param board The position, unchanged on return.
+ * @param success Set to false if a table is missing or corrupt.
+ * @return Plies to the next capture or pawn move in optimal play, positive when the side to move wins and
+ *         beyond +-100 for cursed wins and blessed losses, 0 for draws.
+ */
+int tb_probe_dtz(uint64_t* board, bool* success){
+    int state = PROBE_OK;
+    int dtz = probe_dtz(board, &state);
+    *success = state != PROBE_FAIL;
+    return dtz;
+}
+
+/**
+ * Picks the root move from the DTZ tables: among the moves that keep the best result, the fastest conversion
+ * when winning and the longest resistance when losing.
+ * @param board The root position, unchanged on return.
+ * @param best Set to the chosen move.
+ * @param wdl Set to the TB_WDL value of the root for the side to move.
+ * @return Whether the root was found in the tables, search should run normally if not.
+ */
+bool tb_probe_root(uint64_t* board, Move* best, int* wdl){
+    if (!tb_can_probe(board)) return false;
+
+    Move movs[MOVES_ARRAY_LENGTH];
+    Move replies[MOVES_ARRAY_LENGTH];
+    if (get_legal_moves(movs, board) == 0) return false;
+
+    int best_rank = INT32_MIN, best_dtz = 0;
+    int state = PROBE_OK;
+    for (Move* movptr = movs; movptr->type != BOOK_END; movptr++){
+        int dtz;
+        apply_move(movptr, board);
+        if (is_zeroing(movptr)){
+            state = PROBE_OK;
+            dtz = dtz_before_zeroing(-probe_search(board, &state, false));
+        } else {
+            dtz = -probe_dtz(board, &state);
+            dtz = dtz > 0 ? dtz + 1 : dtz < 0 ? dtz - 1 : 0;
+        }
+        if (dtz == 2 && in_check(board) && get_legal_moves(replies, board) == 0){
+            dtz = 1; // mate
+        }
+        apply_move(movptr, board);
+        if (state == PROBE_FAIL) return false;
+
+        // certain wins rank equally, then the shortest DTZ among them decides. losses rank equally unless the 50 move rule could save them
+        int rank = dtz > 0 ? (dtz <= 99 ? TB_MAX_DTZ : TB_MAX_DTZ - dtz)
+                 : dtz < 0 ? (-dtz * 2 < 100 ? -TB_MAX_DTZ : -TB_MAX_DTZ - dtz)
+                 : 0;
+        bool better = rank > best_rank
+                   || (rank == best_rank && dtz != 0 && dtz < best_dtz);
+        if (better){
+            best_rank = rank;
+            best_dtz = dtz;
+            *best = *movptr;
+        }
+    }
+    *wdl = best_dtz > 0 ? (best_dtz <= 100 ? TB_WIN : TB_CURSED_WIN)
+         : best_dtz < 0 ? (best_dtz >= -100 ? TB_LOSS : TB_BLESSED_LOSS)
+         : TB_DRAW;
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "get_moves.h"
+
+#define TB_PIECES 7 // largest tables in the syzygy format
+#define TB_WIN_SCORE 20000 // above any static eval, below mate scores
+#define TB_DEFAULT_PROBE_DEPTH 1
+#define TB_DEFAULT_PROBE_LIMIT 7
+
+// win/draw/loss from the side to move's point of view. cursed wins and blessed losses are wins and losses that the 50 move rule turns into draws
+enum TB_WDL {
+    TB_LOSS = -2,
+    TB_BLESSED_LOSS = -1,
+    TB_DRAW = 0,
+    TB_CURSED_WIN = 1,
+    TB_WIN = 2
+};
+
+extern int SyzygyProbeDepth; // remaining depth needed before probing in search
+extern int SyzygyProbeLimit; // most pieces, kings included, probed in search
+
+int tb_init(const char* path);
+void tb_free();
+int tb_cardinality();
+bool tb_can_probe(const uint64_t* board);
+int tb_probe_wdl(uint64_t* board, bool* success);
+int tb_probe_dtz(uint64_t* board, bool* success);
+bool tb_probe_root(uint64_t* board, Move* best, int* wdl);
@@ -1,6 +1,50 @@
+#include "testing.h"
 #include "constants.h"
 #include "get_moves.h"
 #include "hash_table.h"
+#include "helpers.h"
+#include "eval.h"
+#include "search.h"
+#include "perf_counters.h"
+#include "pgn.h"
+#include "book.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+// positions cycled through by the benchmarks when no csv of positions is given
+static const char* BENCH_FENS[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "2r3k1/5ppp/p3p3/1p1n4/3P4/P3BP2/1P3KPP/2R5 b - - 0 28",
+    "8/8/4k3/8/2K5/8/3Q4/8 w - - 0 60"
+};
+#define NUM_BENCH_FENS (int)(sizeof(BENCH_FENS) / sizeof(BENCH_FENS[0]))
+#define PLAYOUT_MAX_PLIES 40 // random plies played from the built in positions to build a corpus
+
+// positions reached by a fixed sequence of random legal moves from the built in positions, the same on every run
+static uint64_t** build_playout_corpus(int size){
+    uint64_t** corpus = malloc(size * sizeof(uint64_t*));
+    uint64_t state = PRIME;
+    Move movs[MOVES_ARRAY_LENGTH];
+    for (int i = 0; i < size; i++){
+        corpus[i] = from_FEN(BENCH_FENS[i % NUM_BENCH_FENS]);
+        state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+        for (int ply = state % PLAYOUT_MAX_PLIES; ply > 0; ply--){
+            int n = get_legal_moves(movs, corpus[i]);
+            if (n == 0) break;
+            state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+            apply_move(&movs[state % n], corpus[i]);
+        }
+    }
+    return corpus;
+}
 
 void hash_testing(char* FEN){
     uint64_t* board = from_FEN(FEN);
@@ -67,4 +111,422 @@ void hash_testing(char* FEN){
     if (mov2match != total) printf("\nmov2 %d != %d | %s", total, mov2match, FEN);
     if (mov3match != total) printf("\nmov3 %d != %d | %s", total, mov3match, FEN);
     if (typematch != total) printf("\ntype %d != %d | %s", total, typematch, FEN);
-    if (infomatch != total) printf("\ninfo %d != %d | %s", total, infomatch, FEN);}
\ No newline at end of file
+    if (infomatch != total) printf("\ninfo %d != %d | %s", total, infomatch, FEN);}
+
+// EVAL BENCHMARK
+
+/**
+ * Times evaluate() one board at a time against evaluate_batch() over the same positions and checks that both agree.
+ * @param filename Csv of positions to read (see read_pos_csv), or NULL for random playouts from the built in positions.
+ * @param num_positions The number of positions in the batch.
+ * @param reps The number of times each position is evaluated.
+ */
+void eval_batch_benchmark(const char* filename, int num_positions, int reps){
+    char** FENs = calloc(num_positions, sizeof(char*));
+    if (filename != NULL){
+        read_pos_csv(filename, FENs, num_positions);
+    }
+    uint64_t** boards = build_playout_corpus(num_positions);
+    BoardBatch* batch = create_board_batch(num_positions);
+    int16_t* evals = malloc(num_positions * sizeof(int16_t));
+    for (int i = 0; i < num_positions; i++){
+        if (FENs[i] != NULL){
+            free_board(boards[i]);
+            boards[i] = from_FEN(FENs[i]);
+        }
+        add_to_batch(batch, boards[i]);
+    }
+
+    volatile int32_t sink = 0; // keeps the scalar loop from being optimized away
+    clock_t start = clock();
+    for (int r = 0; r < reps; r++){
+        for (int i = 0; i < num_positions; i++){
+            sink += evaluate(boards[i]);
+        }
+    }
+    double scalar_ms = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (int r = 0; r < reps; r++){
+        evaluate_batch(batch, evals);
+    }
+    double batch_ms = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+
+    int mismatches = 0;
+    for (int i = 0; i < num_positions; i++){
+        if (evals[i] != evaluate(boards[i])) mismatches++;
+    }
+
+    double total = (double)num_positions * reps;
+    printf("evaluate:       %.0f ms, %.2f M positions/s\n", scalar_ms, total / (scalar_ms * 1000.0));
+    printf("evaluate_batch: %.0f ms, %.2f M positions/s (%s)\n", batch_ms, total / (batch_ms * 1000.0),
+#ifdef __AVX2__
+        "avx2"
+#else
+        "scalar"
+#endif
+    );
+    printf("speedup %.2fx, %d mismatches\n", scalar_ms / batch_ms, mismatches);
+
+    for (int i = 0; i < num_positions; i++){
+        free_board(boards[i]);
+        free(FENs[i]);
+    }
+    free(boards);
+    free(FENs);
+    free(evals);
+    free_board_batch(batch);
+}
+
+// SEARCH BENCHMARK
+
+/**
+ * Searches the built in positions to a fixed depth from a cleared transposition table and history, single threaded. The total node
+ * count only depends on the search and evaluation, so it must stay the same across pure speedups: a change to it is a functional
+ * change. Run before any bitbases or tablebases are loaded, they change the tree.
+ * @param depth Depth of the iterative deepening on each position.
+ * @param FEN A single position to search instead of the built in ones, or NULL.
+ * @param json Prints one JSON object instead of the table, for tracking results between commits.
+ * @param perf Counts hardware events around the searches (see perf_counters.c) and reports them per node.
+ */
+void search_bench(int depth, const char* FEN, bool json, bool perf){
+    const char** fens = FEN != NULL ? &FEN : BENCH_FENS;
+    int num_fens = FEN != NULL ? 1 : NUM_BENCH_FENS;
+    uint64_t nodes[NUM_BENCH_FENS];
+    long times[NUM_BENCH_FENS];
+    uint64_t total_nodes = 0;
+    long total_time = 0;
+
+    Engine* engine = create_engine(); // a fresh one, so earlier searches do not change the count
+    if (engine == NULL){
+        printf("Error allocating engine\n");
+        return;
+    }
+    reset_search_profile();
+    PerfCounters counters;
+    if (perf){
+        perf_start(&counters); // without access only the timing is reported
+    }
+    for (int i = 0; i < num_fens; i++){
+        uint64_t* board = from_FEN(fens[i]);
+        engine->stop = false;
+        start_search_clock(engine, 0, NULL);
+        for (int d = 1; d <= depth; d++){
+            free_search_result(search(engine, board, d, INT16_MIN, INT16_MAX));
+        }
+        nodes[i] = get_search_stats(engine).nodes;
+        times[i] = search_elapsed(engine);
+        total_nodes += nodes[i];
+        total_time += times[i];
+        free_board(board);
+        if (!json){
+            printf("Position %d/%d: %llu nodes, %ld ms\n", i + 1, num_fens, (unsigned long long)nodes[i], times[i]);
+        }
+    }
+    if (perf){
+        perf_stop(&counters);
+    }
+    free_engine(engine);
+    if (dump_search_profile(SEARCH_PROFILE_FILE) && !json){
+        printf("Search profile written to %s\n", SEARCH_PROFILE_FILE);
+    }
+
+    unsigned long long nps = total_nodes * 1000 / (total_time ? total_time : 1);
+    if (json){
+        printf("{\"depth\": %d, \"positions\": %d, \"nodes\": %llu, \"time_ms\": %ld, \"nps\": %llu, \"position_nodes\": [", depth, num_fens, (unsigned long long)total_nodes, total_time, nps);
+        for (int i = 0; i < num_fens; i++){
+            printf("%s%llu", i ? ", " : "", (unsigned long long)nodes[i]);
+        }
+        printf("]");
+        if (perf){
+            printf(", ");
+            perf_report(&counters, total_nodes, true, stdout);
+        }
+        printf("}\n");
+    } else {
+        printf("===========================\n");
+        printf("Total time (ms) : %ld\n", total_time);
+        printf("Nodes searched  : %llu\n", (unsigned long long)total_nodes);
+        printf("Nodes/second    : %llu\n", nps);
+        if (perf){
+            perf_report(&counters, total_nodes, false, stdout);
+        }
+    }
+    fflush(stdout);
+}
+
+// MICROBENCHMARKS
+// times the hot kernels one at a time over a corpus of positions, so a change to one of them can be measured in isolation. each
+// sample repeats the corpus until it has run long enough to time, the first sample is a warmup and the rest give the mean and spread
+
+#define MICRO_CORPUS_SIZE 1024
+#define MICRO_SAMPLES 10
+#define MICRO_SAMPLE_NS 20000000 // minimum length of a sample
+
+// runs one kernel over a position, adds the number of calls made and returns something derived from the results
+typedef uint64_t (*MicroKernel)(uint64_t* board, uint64_t* calls);
+
+static uint64_t micro_knight_moves(uint64_t* board, uint64_t* calls){
+    Move movs[MOVES_ARRAY_LENGTH];
+    Move* movptr = movs;
+    get_white_knight_moves(&movptr, board);
+    (*calls)++;
+    return movptr - movs;
+}
+
+static uint64_t micro_bishop_attacks(uint64_t* board, uint64_t* calls){
+    uint64_t result = 0;
+    for (uint64_t pcs = board[WHITE_BISHOP] | board[WHITE_QUEEN]; pcs; pcs &= pcs - 1){
+        result ^= get_white_bishop_attacks(board, pcs & -pcs);
+        (*calls)++;
+    }
+    return result;
+}
+
+static uint64_t micro_black_attackers(uint64_t* board, uint64_t* calls){
+    (*calls)++;
+    return get_black_attackers(board);
+}
+
+static uint64_t micro_evaluate(uint64_t* board, uint64_t* calls){
+    (*calls)++;
+    return (uint16_t)evaluate(board);
+}
+
+static uint64_t micro_hash(uint64_t* board, uint64_t* calls){
+    (*calls)++;
+    return get_hash(board);
+}
+
+static const struct {
+    const char* name;
+    MicroKernel kernel;
+} MICRO_KERNELS[] = {
+    {"get_white_knight_moves", micro_knight_moves},
+    {"get_white_bishop_attacks", micro_bishop_attacks},
+    {"get_black_attackers", micro_black_attackers},
+    {"evaluate", micro_evaluate},
+    {"get_hash", micro_hash}
+};
+#define NUM_MICRO_KERNELS (int)(sizeof(MICRO_KERNELS) / sizeof(MICRO_KERNELS[0]))
+
+static double now_ns(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/**
+ * Times each kernel over a corpus of positions and prints ns per call, calls per second and the spread between samples.
+ * @param filename Csv of positions to use as the corpus (see read_pos_csv), or NULL for random playouts from the built in positions.
+ */
+void micro_benchmark(const char* filename){
+    int size = MICRO_CORPUS_SIZE;
+    uint64_t** corpus;
+    if (filename != NULL){
+        char** FENs = calloc(size, sizeof(char*));
+        read_pos_csv(filename, FENs, size);
+        corpus = malloc(size * sizeof(uint64_t*));
+        int count = 0;
+        for (int i = 0; i < size; i++){
+            if (FENs[i] != NULL) corpus[count++] = from_FEN(FENs[i]);
+            free(FENs[i]);
+        }
+        free(FENs);
+        size = count;
+        if (size == 0){
+            printf("No positions in %s\n", filename);
+            free(corpus);
+            return;
+        }
+    } else {
+        corpus = build_playout_corpus(size);
+    }
+
+    volatile uint64_t sink = 0; // keeps the kernels from being optimized away
+    printf("%d positions, %d samples of at least %d ms\n", size, MICRO_SAMPLES, MICRO_SAMPLE_NS / 1000000);
+    printf("%-26s %10s %10s %10s %14s\n", "kernel", "ns/call", "stddev", "min", "calls/s");
+    for (int k = 0; k < NUM_MICRO_KERNELS; k++){
+        double samples[MICRO_SAMPLES];
+        for (int s = -1; s < MICRO_SAMPLES; s++){
+            uint64_t calls = 0, result = 0;
+            double start = now_ns(), elapsed;
+            do {
+                for (int i = 0; i < size; i++){
+                    result += MICRO_KERNELS[k].kernel(corpus[i], &calls);
+                }
+                elapsed = now_ns() - start;
+            } while (elapsed < MICRO_SAMPLE_NS);
+            sink += result;
+            if (s >= 0) samples[s] = calls ? elapsed / calls : 0;
+        }
+
+        double mean = 0, variance = 0, best = samples[0];
+        for (int s = 0; s < MICRO_SAMPLES; s++){
+            mean += samples[s] / MICRO_SAMPLES;
+            best = fmin(best, samples[s]);
+        }
+        for (int s = 0; s < MICRO_SAMPLES; s++){
+            variance += (samples[s] - mean) * (samples[s] - mean) / (MICRO_SAMPLES - 1);
+        }
+        printf("%-26s %10.2f %10.2f %10.2f %14.0f\n", MICRO_KERNELS[k].name, mean, sqrt(variance), best, mean > 0 ? 1e9 / mean : 0);
+    }
+    fflush(stdout);
+
+    for (int i = 0; i < size; i++){
+        free_board(corpus[i]);
+    }
+    free(corpus);
+}
+
+// CHECKS
+// known answers for the parts of the engine that talk to the outside: moves read from PGN, keys shared with Polyglot books and
+// tables saved to disk. each failure is printed, a clean run prints the counts only
+#define CHECK_TABLE_FILE "check_table.tt"
+#define CHECK_TABLE_MB 1
+
+static const char* START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+// a SAN move in a position and the move it names in UCI
+typedef struct SanCheck {
+    const char* fen;
+    const char* san;
+    const char* uci;
+} SanCheck;
+
+static const SanCheck SAN_CHECKS[] = {
+    {"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "O-O", "e1g1"},
+    {"r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1", "O-O-O+", "e1c1"},
+    {"r3k2r/8/8/8/8/8/8/R3K2R b KQkq - 0 1", "O-O", "e8g8"},
+    {"r3k2r/8/8/8/8/8/8/R3K2R b KQkq - 0 1", "O-O-O", "e8c8"},
+    {"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3", "exf6", "e5f6"},
+    {"rnbqkbnr/pppp1ppp/8/8/3Pp3/8/PPP1PPPP/RNBQKBNR b KQkq d3 0 2", "exd3", "e4d3"},
+    {"8/4P3/8/8/8/8/k7/4K3 w - - 0 1", "e8=Q", "e7e8q"},
+    {"3r4/4P3/8/8/8/8/k7/4K3 w - - 0 1", "exd8=N", "e7d8n"},
+    {"4K3/8/8/8/8/8/4p3/k4R2 b - - 0 1", "exf1=R", "e2f1r"},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPP1PPPP/RNBQKBNR w KQkq - 0 1", "Nbd2", "b1d2"},
+    {"rnbqkbnr/pppppppp/8/8/8/5N2/PPPPPPPP/RNBQKB1R w KQkq - 0 1", "Nfd4", "f3d4"},
+    {"4k3/8/8/8/8/4R3/8/4R1K1 w - - 0 1", "R1e2", "e1e2"},
+    {"4k3/8/8/8/8/4R3/8/4R1K1 w - - 0 1", "R3e2", "e3e2"},
+    {"K7/8/k7/8/4Q2Q/8/8/7Q w - - 0 1", "Qh4e1", "h4e1"}
+};
+#define NUM_SAN_CHECKS (int)(sizeof(SAN_CHECKS) / sizeof(SAN_CHECKS[0]))
+
+// the test vectors of the Polyglot book format, moves played from the starting position and the key of the position reached
+typedef struct KeyCheck {
+    const char* moves;
+    uint64_t key;
+} KeyCheck;
+
+static const KeyCheck KEY_CHECKS[] = {
+    {"", 0x463b96181691fc9cULL},
+    {"e2e4", 0x823c9b50fd114196ULL},
+    {"e2e4 d7d5", 0x0756b94461c50fb0ULL},
+    {"e2e4 d7d5 e4e5", 0x662fafb965db29d4ULL},
+    {"e2e4 d7d5 e4e5 f7f5", 0x22a48b5a8e47ff78ULL},
+    {"e2e4 d7d5 e4e5 f7f5 e1e2", 0x652a607ca3f242c1ULL},
+    {"e2e4 d7d5 e4e5 f7f5 e1e2 e8f7", 0x00fdd303c946bdd9ULL},
+    {"a2a4 b7b5 h2h4 b5b4 c2c4", 0x3c8123ea7b067637ULL},
+    {"a2a4 b7b5 h2h4 b5b4 c2c4 b4c3 a1a3", 0x5c3f9b829b279560ULL}
+};
+#define NUM_KEY_CHECKS (int)(sizeof(KEY_CHECKS) / sizeof(KEY_CHECKS[0]))
+
+// each move must be read from SAN, name the expected move, and leave the position as it was when taken back
+static int check_san(){
+    int failed = 0;
+    for (int i = 0; i < NUM_SAN_CHECKS; i++){
+        const SanCheck* c = &SAN_CHECKS[i];
+        uint64_t* board = from_FEN(c->fen);
+        uint64_t before[BOARD_ARRAY_SIZE];
+        memcpy(before, board, sizeof(before));
+        Move mov;
+        char uci[8] = "";
+        if (san_to_move(c->san, strlen(c->san), board, &mov)){
+            format_uci_move(&mov, board, uci, sizeof(uci));
+            apply_move(&mov, board);
+            apply_move(&mov, board);
+        }
+        if (strcmp(uci, c->uci) != 0 || memcmp(before, board, sizeof(before)) != 0){
+            printf("FAIL san %s: got \"%s\", expected %s | %s\n", c->san, uci, c->uci, c->fen);
+            failed++;
+        }
+        free(board);
+    }
+    return failed;
+}
+
+static int check_polyglot_keys(){
+    int failed = 0;
+    for (int i = 0; i < NUM_KEY_CHECKS; i++){
+        const KeyCheck* c = &KEY_CHECKS[i];
+        uint64_t* board = from_FEN(START_FEN);
+        char moves[128];
+        snprintf(moves, sizeof(moves), "%s", c->moves);
+        bool legal = true;
+        for (char* uci = strtok(moves, " "); uci != NULL && legal; uci = strtok(NULL, " ")){
+            Move mov;
+            legal = move_from_uci(uci, board, &mov);
+            if (legal) apply_move(&mov, board);
+        }
+        uint64_t key = polyglot_key(board);
+        if (!legal || key != c->key){
+            printf("FAIL polyglot key after \"%s\": %016llx, expected %016llx\n", c->moves, (unsigned long long)key, (unsigned long long)c->key);
+            failed++;
+        }
+        free(board);
+    }
+    return failed;
+}
+
+// entries of the legal moves of a few positions must come back from a saved table with their move, depth and bound
+static int check_table_file(){
+    TransTable saved, loaded;
+    if (!initilize_trans_table(&saved, CHECK_TABLE_MB) || !initilize_trans_table(&loaded, CHECK_TABLE_MB)){
+        printf("FAIL table: could not allocate\n");
+        return 1;
+    }
+    int failed = 0, entries = 0;
+    uint64_t hashes[NUM_BENCH_FENS];
+    uint64_t codes[NUM_BENCH_FENS];
+    for (int i = 0; i < NUM_BENCH_FENS; i++){
+        uint64_t* board = from_FEN(BENCH_FENS[i]);
+        Move movs[MOVES_ARRAY_LENGTH];
+        if (get_legal_moves(movs, board) > 0){
+            hashes[entries] = get_hash(board);
+            codes[entries] = encrypt_move(&movs[0]) & TT_MOVE_MASK;
+            add_item(&saved, &movs[0], entries % 3, 1 + entries, hashes[entries]);
+            entries++;
+        }
+        free(board);
+    }
+
+    if (!save_trans_table(&saved, CHECK_TABLE_FILE) || !load_trans_table(&loaded, CHECK_TABLE_FILE)){
+        printf("FAIL table: could not save and load %s\n", CHECK_TABLE_FILE);
+        failed++;
+    } else {
+        for (int i = 0; i < entries; i++){
+            TTEntry entry;
+            bool found = query_table(&loaded, hashes[i], &entry);
+            if (!found || TT_ENTRY_DEPTH(&entry) != 1 + i || TT_ENTRY_BOUND(&entry) != i % 3 || (entry.data >> 8) != codes[i]){
+                printf("FAIL table: entry %d %s after loading\n", i, found ? "changed" : "missing");
+                failed++;
+            }
+        }
+    }
+    remove(CHECK_TABLE_FILE);
+    free_trans_table(&saved);
+    free_trans_table(&loaded);
+    return failed;
+}
+
+/**
+ * Runs the known answer checks.
+ * @return The number of failed checks.
+ */
+int run_checks(){
+    int total = NUM_SAN_CHECKS + NUM_KEY_CHECKS + 1;
+    int failed = check_san() + check_polyglot_keys();
+    failed += check_table_file() > 0;
+    printf("%d of %d checks passed\n", total - failed, total);
+    return failed;
+}
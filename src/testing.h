@@ -0,0 +1,10 @@
+#pragma once
+#include <stdbool.h>
+
+#define BENCH_DEFAULT_DEPTH 6
+
+void hash_testing(char* FEN);
+void eval_batch_benchmark(const char* filename, int num_positions, int reps);
+void search_bench(int depth, const char* FEN, bool json, bool perf);
+void micro_benchmark(const char* filename);
+int run_checks();
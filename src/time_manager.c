@@ -0,0 +1,63 @@
+#include "time_manager.h"
+#include "constants.h"
+#include "helpers.h"
+#include <string.h>
+
+// TIME MANAGER
+// splits the clock into a budget per move. the optimum is the remaining time spread over the moves left plus most of the increment.
+// between iterations the soft limit grows while the best move keeps changing and shrinks once it has settled, the hard limit is
+// enforced inside the search (see set_search_time_limit) so a long iteration cannot overrun the clock
+
+static const int STABILITY_SCALE[] = {140, 120, 100, 80, 60, 50}; // percent of the optimum, by iterations without a new best move
+
+/**
+ * Computes the deadlines of a search.
+ * @param tm the time manager to set up
+ * @param limits the time controls sent with "go", no clock and no movetime give an unlimited search
+ * @param start search clock time (ms) the budget starts at
+ */
+void init_time_manager(TimeManager* tm, const TimeLimits* limits, long start){
+    memset(tm, 0, sizeof(TimeManager));
+    tm->start = start;
+    tm->last_best.type = BOOK_END;
+    if (limits->movetime > 0){
+        tm->limited = true;
+        tm->fixed = true;
+        tm->optimum = tm->soft = tm->hard = max(limits->movetime - MOVE_OVERHEAD, 1);
+    } else if (limits->time_left >= 0){
+        tm->limited = true;
+        long available = max(limits->time_left - MOVE_OVERHEAD, 1);
+        int moves_to_go = limits->moves_to_go > 0 ? min(limits->moves_to_go, MAX_MOVES_TO_GO) : DEFAULT_MOVES_TO_GO;
+        tm->hard = min(available / moves_to_go * HARD_LIMIT_FACTOR + limits->increment, available * 3 / 4);
+        tm->hard = max(tm->hard, 1);
+        tm->optimum = min(available / moves_to_go + limits->increment * 3 / 4, tm->hard);
+        tm->soft = tm->optimum;
+    }
+}
+
+/**
+ * Called after each completed iteration, updates the best move's stability and decides whether to search one ply deeper.
+ * @param tm the time manager of the search
+ * @param best result of the completed iteration
+ * @param elapsed search clock time (ms)
+ * @return false once the next iteration would run past the soft limit, or a mate has been found. always true for a fixed movetime
+ * until a mate is found
+ */
+bool time_for_next_iteration(TimeManager* tm, const searchResult* best, long elapsed){
+    if (!tm->limited) return true;
+    // a mate found by iterative deepening is the shortest one, searching deeper cannot change the move
+    if (best->best_move.type == BOOK_END || is_mate_score(best->best_eval)) return false;
+    // a fixed movetime is used in full, the hard limit ends the last iteration
+    if (tm->fixed) return true;
+
+    if (tm->last_best.type != BOOK_END && same_move(&tm->last_best, &best->best_move)){
+        tm->stability++;
+    } else {
+        tm->stability = 0;
+    }
+    tm->last_best = best->best_move;
+    int scale = STABILITY_SCALE[min(tm->stability, (int)(sizeof(STABILITY_SCALE) / sizeof(STABILITY_SCALE[0])) - 1)];
+    tm->soft = min(tm->optimum * scale / 100, tm->hard);
+    // the next iteration takes longer than all before it together, one started past half the soft limit would rarely finish
+    return elapsed - tm->start < tm->soft / 2;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "search.h"
+#include <stdbool.h>
+
+#define MOVE_OVERHEAD 20 // ms kept back per move for communication with the GUI
+#define DEFAULT_MOVES_TO_GO 30 // moves the remaining time is spread over in sudden death
+#define MAX_MOVES_TO_GO 50
+#define HARD_LIMIT_FACTOR 4 // the hard limit may be this many times the optimum
+
+// time controls of a search as sent with "go", in ms
+typedef struct TimeLimits {
+    long time_left; // on the clock of the side to move, -1 when not given
+    long increment;
+    int moves_to_go; // until the next time control, 0 for sudden death
+    long movetime; // fixed time for the move, 0 when not given
+} TimeLimits;
+
+// soft and hard deadlines of one search, in ms since the time manager was started
+typedef struct TimeManager {
+    long start; // search clock time the budget starts at, moved when a ponder search turns into a timed one
+    long optimum; // time the move is normally given
+    long soft; // no new iteration is started once it has passed, scaled by the best move's stability
+    long hard; // the search is stopped in the middle of an iteration
+    bool limited; // false for depth limited, infinite and ponder searches
+    bool fixed; // "go movetime", searched until the hard limit
+    Move last_best;
+    int stability; // iterations the best move has not changed
+} TimeManager;
+
+void init_time_manager(TimeManager* tm, const TimeLimits* limits, long start);
+bool time_for_next_iteration(TimeManager* tm, const searchResult* best, long elapsed);
@@ -0,0 +1,336 @@
+#include "tune.h"
+#include "constants.h"
+#include "helpers.h"
+#include "eval.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// TEXEL TUNER
+// fits the piece square tables and phase weights to game results. minimizes the mean squared error between each position's result
+// (1 for a white win, 0.5 for a draw, 0 for a black win) and sigmoid(eval), by gradient descent (adam) with the gradient of each epoch
+// summed over all positions by a pool of worker threads. black's tables are kept as the mirror of white's, so only white's are tuned
+
+#define NUM_PARAMS (2 * 6 * 64 + 6)
+#define MG_INDEX(type, sq) ((type) * 64 + (sq))
+#define EG_INDEX(type, sq) (384 + (type) * 64 + (sq))
+#define PHASE_INDEX(type) (768 + (type))
+
+#define feature_is_black(f) ((f) >> 9)
+#define feature_type(f) (((f) >> 6) & 7)
+#define feature_sq(f) ((f) & 63)
+
+// LOADING POSITIONS
+
+static int push_position(TuneSet* set, const uint64_t* board, uint8_t result){
+    if (set->count + 1 >= set->capacity){
+        int capacity = set->capacity * 2;
+        uint32_t* starts = realloc(set->starts, (capacity + 1) * sizeof(uint32_t));
+        uint8_t* results = realloc(set->results, capacity * sizeof(uint8_t));
+        if (starts) set->starts = starts;
+        if (results) set->results = results;
+        if (!starts || !results) return 0;
+        set->capacity = capacity;
+    }
+    if (set->num_features + 32 >= set->feature_capacity){
+        uint32_t capacity = set->feature_capacity * 2;
+        uint16_t* features = realloc(set->features, capacity * sizeof(uint16_t));
+        if (!features) return 0;
+        set->features = features;
+        set->feature_capacity = capacity;
+    }
+
+    for (int pc = WHITE_PAWN; pc <= BLACK_KING; pc++){
+        int black = pc >= BLACK_PAWN;
+        int type = black ? pc - BLACK_PAWN : pc;
+        for (uint64_t pcs = board[pc]; pcs; pcs &= (pcs - 1)){
+            int sq = __builtin_ctzll(pcs);
+            if (set->num_features - set->starts[set->count] == 32) break; // more pieces than a legal position can have
+            set->features[set->num_features++] = (black << 9) | (type << 6) | (black ? sq ^ 56 : sq);
+        }
+    }
+    set->results[set->count++] = result;
+    set->starts[set->count] = set->num_features;
+    return 1;
+}
+
+// reads the result field of a line: 1-0, 0-1, 1/2-1/2 or a number 1, 0.5, 0. returns -1 if it is not a result
+static int parse_result(const char* p){
+    while (*p == ' ' || *p == '"' || *p == '[') p++;
+    if (strncmp(p, "1/2", 3) == 0) return 1;
+    if (strncmp(p, "1-0", 3) == 0) return 2;
+    if (strncmp(p, "0-1", 3) == 0) return 0;
+    char* end;
+    double value = strtod(p, &end);
+    if (end == p) return -1;
+    if (value > 0.75) return 2;
+    if (value < 0.25) return 0;
+    return 1;
+}
+
+/**
+ * Streams a file of labelled positions, one "FEN,result" per line, into compact in-memory form. Lines without a result are skipped.
+ * @param filename The file to read.
+ * @return A pointer to the loaded positions, or NULL if the file could not be read.
+ */
+TuneSet* load_tune_set(const char* filename){
+    FILE* file = fopen(filename, "r");
+    if (!file){
+        printf("Error opening file\n");
+        return NULL;
+    }
+    TuneSet* set = calloc(1, sizeof(TuneSet));
+    if (set != NULL){
+        set->capacity = 1 << 16;
+        set->feature_capacity = 1 << 20;
+        set->starts = malloc((set->capacity + 1) * sizeof(uint32_t));
+        set->results = malloc(set->capacity * sizeof(uint8_t));
+        set->features = malloc(set->feature_capacity * sizeof(uint16_t));
+    }
+    if (set == NULL || set->starts == NULL || set->results == NULL || set->features == NULL){
+        printf("Out of memory\n");
+        free_tune_set(set);
+        fclose(file);
+        return NULL;
+    }
+    set->starts[0] = 0;
+
+    char line[400];
+    while (fgets(line, sizeof(line), file)){
+        char* comma_pos = strrchr(line, ',');
+        if (comma_pos == NULL) continue;
+        int result = parse_result(comma_pos + 1);
+        if (result < 0) continue; // header or malformed line
+        *comma_pos = '\0';
+        uint64_t* board = from_FEN(line);
+        int pushed = push_position(set, board, (uint8_t)result);
+        free_board(board);
+        if (!pushed){
+            printf("Out of memory after %d positions\n", set->count);
+            break;
+        }
+    }
+    fclose(file);
+    return set;
+}
+
+/**
+ * Frees the memory allocated for a set of labelled positions.
+ * @param set The positions to be freed.
+ */
+void free_tune_set(TuneSet* set){
+    if (set == NULL) return;
+    free(set->features);
+    free(set->starts);
+    free(set->results);
+    free(set);
+}
+
+// EVAL AND GRADIENT
+
+// same formula as evaluate, in floating point over the tuned parameters
+static double tune_eval(const TuneSet* set, int i, const double* params, double* mg_out, double* eg_out, double* phase_out){
+    double mg = 0, eg = 0, phase = 0;
+    for (uint32_t f = set->starts[i]; f < set->starts[i + 1]; f++){
+        uint16_t feature = set->features[f];
+        double sign = feature_is_black(feature) ? -1.0 : 1.0;
+        mg += sign * params[MG_INDEX(feature_type(feature), feature_sq(feature))];
+        eg += sign * params[EG_INDEX(feature_type(feature), feature_sq(feature))];
+        phase += params[PHASE_INDEX(feature_type(feature))];
+    }
+    *mg_out = mg;
+    *eg_out = eg;
+    *phase_out = phase;
+    if (phase > 24){
+        return mg;
+    }
+    return (mg * phase + eg * (24 - phase)) / 24;
+}
+
+static inline double sigmoid(double K, double eval){
+    return 1.0 / (1.0 + pow(10.0, -K * eval / 400.0));
+}
+
+typedef struct TuneWorker {
+    pthread_t thread;
+    const TuneSet* set;
+    const double* params;
+    double K;
+    int start, end;
+    int with_gradient;
+    double error;
+    double gradient[NUM_PARAMS];
+} TuneWorker;
+
+// sums the squared error, and optionally its gradient, over the worker's slice of positions
+static void* tune_worker(void* arg){
+    TuneWorker* worker = arg;
+    const TuneSet* set = worker->set;
+    const double* params = worker->params;
+    double mg, eg, phase;
+    worker->error = 0;
+    if (worker->with_gradient){
+        memset(worker->gradient, 0, sizeof(worker->gradient));
+    }
+
+    for (int i = worker->start; i < worker->end; i++){
+        double s = sigmoid(worker->K, tune_eval(set, i, params, &mg, &eg, &phase));
+        double diff = s - set->results[i] * 0.5;
+        worker->error += diff * diff;
+        if (!worker->with_gradient) continue;
+
+        // d(error)/d(eval), then spread over the parameters each piece touches
+        double d_eval = 2.0 * diff * s * (1.0 - s) * worker->K * log(10.0) / 400.0;
+        double mg_weight = phase > 24 ? 1.0 : phase / 24.0;
+        double eg_weight = phase > 24 ? 0.0 : (24.0 - phase) / 24.0;
+        double d_phase = phase > 24 ? 0.0 : d_eval * (mg - eg) / 24.0;
+        for (uint32_t f = set->starts[i]; f < set->starts[i + 1]; f++){
+            uint16_t feature = set->features[f];
+            double sign = feature_is_black(feature) ? -d_eval : d_eval;
+            worker->gradient[MG_INDEX(feature_type(feature), feature_sq(feature))] += sign * mg_weight;
+            worker->gradient[EG_INDEX(feature_type(feature), feature_sq(feature))] += sign * eg_weight;
+            worker->gradient[PHASE_INDEX(feature_type(feature))] += d_phase;
+        }
+    }
+    return NULL;
+}
+
+// runs one pass over all positions split across the workers, returns the mean squared error and leaves the summed gradient in gradient
+static double run_workers(TuneWorker* workers, int num_threads, const double* params, double K, double* gradient){
+    for (int t = 0; t < num_threads; t++){
+        workers[t].params = params;
+        workers[t].K = K;
+        workers[t].with_gradient = gradient != NULL;
+        pthread_create(&workers[t].thread, NULL, tune_worker, &workers[t]);
+    }
+    double error = 0;
+    if (gradient != NULL){
+        memset(gradient, 0, NUM_PARAMS * sizeof(double));
+    }
+    for (int t = 0; t < num_threads; t++){
+        pthread_join(workers[t].thread, NULL);
+        error += workers[t].error;
+        for (int p = 0; gradient != NULL && p < NUM_PARAMS; p++){
+            gradient[p] += workers[t].gradient[p];
+        }
+    }
+    return error / workers[0].set->count;
+}
+
+// scaling constant of the sigmoid that best fits the starting parameters, found by golden section search
+static double fit_K(TuneWorker* workers, int num_threads, const double* params){
+    const double ratio = 0.6180339887;
+    double lo = 0.1, hi = 3.0;
+    for (int iter = 0; iter < 25; iter++){
+        double a = hi - ratio * (hi - lo);
+        double b = lo + ratio * (hi - lo);
+        if (run_workers(workers, num_threads, params, a, NULL) < run_workers(workers, num_threads, params, b, NULL)){
+            hi = b;
+        } else {
+            lo = a;
+        }
+    }
+    return (lo + hi) / 2;
+}
+
+// copies tuned parameters into the engine's tables, rounded, so they can be written with save_eval_params
+static void store_params(const double* params){
+    for (int type = WHITE_PAWN; type <= WHITE_KING; type++){
+        double weight = round(params[PHASE_INDEX(type)]);
+        mg_to_eg_values[type] = mg_to_eg_values[type + BLACK_PAWN] = (int16_t)(weight < 0 ? 0 : weight);
+        for (int sq = 0; sq < 64; sq++){
+            mg_piece_table[(type<<6) + sq] = mg_piece_table[((type + BLACK_PAWN)<<6) + (sq ^ 56)] = (int16_t)round(params[MG_INDEX(type, sq)]);
+            eg_piece_table[(type<<6) + sq] = eg_piece_table[((type + BLACK_PAWN)<<6) + (sq ^ 56)] = (int16_t)round(params[EG_INDEX(type, sq)]);
+        }
+    }
+    init_eval_tables();
+}
+
+// TUNING MODE
+
+/**
+ * Tunes the eval parameters, starting from the engine's current tables, on a file of labelled positions and writes the result to a parameter file.
+ * @param data_filename File of "FEN,result" lines.
+ * @param params_filename Parameter file to write, rewritten every 50 epochs so progress is kept if tuning is stopped.
+ * @param epochs The number of gradient descent steps.
+ * @param num_threads The number of worker threads, 0 for one per core.
+ */
+void tune(const char* data_filename, const char* params_filename, int epochs, int num_threads){
+    TuneSet* set = load_tune_set(data_filename);
+    if (set == NULL || set->count == 0){
+        printf("No positions loaded from %s\n", data_filename);
+        free_tune_set(set);
+        return;
+    }
+    if (num_threads <= 0){
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads > set->count) num_threads = set->count;
+    if (num_threads < 1) num_threads = 1;
+    printf("Loaded %d positions, tuning with %d threads\n", set->count, num_threads);
+
+    TuneWorker* workers = malloc(num_threads * sizeof(TuneWorker));
+    double* params = malloc(NUM_PARAMS * sizeof(double));
+    double* gradient = malloc(NUM_PARAMS * sizeof(double));
+    double* m = calloc(NUM_PARAMS, sizeof(double));
+    double* v = calloc(NUM_PARAMS, sizeof(double));
+    if (!workers || !params || !gradient || !m || !v){
+        printf("Out of memory\n");
+        free(workers);
+        free(params);
+        free(gradient);
+        free(m);
+        free(v);
+        free_tune_set(set);
+        return;
+    }
+    for (int t = 0; t < num_threads; t++){
+        workers[t].set = set;
+        workers[t].start = (int)((long long)set->count * t / num_threads);
+        workers[t].end = (int)((long long)set->count * (t + 1) / num_threads);
+    }
+    for (int type = WHITE_PAWN; type <= WHITE_KING; type++){
+        params[PHASE_INDEX(type)] = mg_to_eg_values[type];
+        for (int sq = 0; sq < 64; sq++){
+            params[MG_INDEX(type, sq)] = mg_piece_table[(type<<6) + sq];
+            params[EG_INDEX(type, sq)] = eg_piece_table[(type<<6) + sq];
+        }
+    }
+
+    double K = fit_K(workers, num_threads, params);
+    printf("K = %.4f, starting error %.6f\n", K, run_workers(workers, num_threads, params, K, NULL));
+
+    // adam
+    const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8;
+    for (int epoch = 1; epoch <= epochs; epoch++){
+        double error = run_workers(workers, num_threads, params, K, gradient);
+        for (int p = 0; p < NUM_PARAMS; p++){
+            double g = gradient[p] / set->count;
+            m[p] = beta1 * m[p] + (1 - beta1) * g;
+            v[p] = beta2 * v[p] + (1 - beta2) * g * g;
+            double m_hat = m[p] / (1 - pow(beta1, epoch));
+            double v_hat = v[p] / (1 - pow(beta2, epoch));
+            double rate = p >= PHASE_INDEX(0) ? TUNE_PHASE_LEARNING_RATE : TUNE_LEARNING_RATE;
+            params[p] -= rate * m_hat / (sqrt(v_hat) + epsilon);
+        }
+        if (epoch % 10 == 0 || epoch == epochs){
+            printf("Epoch %d, error %.6f\n", epoch, error);
+            fflush(stdout);
+        }
+        if (epoch % 50 == 0 || epoch == epochs){
+            store_params(params);
+            save_eval_params(params_filename);
+        }
+    }
+    printf("Wrote %s\n", params_filename);
+
+    free(params);
+    free(gradient);
+    free(m);
+    free(v);
+    free(workers);
+    free_tune_set(set);
+}
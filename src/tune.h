@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+#define TUNE_DEFAULT_EPOCHS 500
+#define TUNE_LEARNING_RATE 1.0
+#define TUNE_PHASE_LEARNING_RATE 0.05 // phase weights are small integers, so they move much slower than table entries
+
+// labelled positions in compact form: each piece is stored as one feature,
+// (black << 9) | (piece type << 6) | square from its own side's point of view
+typedef struct TuneSet {
+    uint16_t* features;
+    uint32_t* starts;   // first feature of each position, starts[count] is one past the last feature
+    uint8_t* results;   // game result in half points for white (0, 1 or 2)
+    int count;
+    int capacity;
+    uint32_t num_features;
+    uint32_t feature_capacity;
+} TuneSet;
+
+TuneSet* load_tune_set(const char* filename);
+void free_tune_set(TuneSet* set);
+void tune(const char* data_filename, const char* params_filename, int epochs, int num_threads);
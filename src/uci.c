@@ -0,0 +1,492 @@
+#include "uci.h"
+#include "constants.h"
+#include "get_moves.h"
+#include "search.h"
+#include "helpers.h"
+#include "hash_table.h"
+#include "tbprobe.h"
+#include "bitbase.h"
+#include "time_manager.h"
+#include "analysis_cache.h"
+#include "book.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+// UCI FRONT END
+// speaks the universal chess interface on stdin/stdout. the game is kept between commands: a "position" command that extends the
+// previous one only applies the new moves, and the engine's transposition table and history scores stay warm until "ucinewgame". "go"
+// starts the search on its own thread so "stop", "isready" and "ponderhit" are answered while it runs. outside the protocol,
+// "savehash <file>" and "loadhash <file>" keep the table across restarts
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+// position of the current game: the starting FEN and the moves played from it
+typedef struct Game {
+    uint64_t* board;
+    char fen[128];
+    char moves[UCI_MAX_GAME_PLIES][6];
+    int num_moves;
+} Game;
+
+static Game game = {NULL, "", {{0}}, 0};
+static Engine* engine = NULL; // of the session, see uci_loop
+
+// writes the principal variation as space separated UCI moves, returns its length in plies
+static int pv_to_string(searchResult* sr, uint64_t* board, char* out, size_t size){
+    Move* line[UCI_MAX_GAME_PLIES];
+    int length = 0;
+    size_t used = 0;
+    out[0] = 0;
+    for (searchResult* r = sr; r != NULL && r->best_move.type != BOOK_END && length < UCI_MAX_GAME_PLIES; r = r->best_result){
+        char name[8];
+        format_uci_move(&r->best_move, board, name, sizeof(name));
+        used += snprintf(out + min(used, size - 1), size - min(used, size - 1), "%s%s", length ? " " : "", name);
+        apply_move(&r->best_move, board);
+        line[length++] = &r->best_move;
+    }
+    for (int i = length - 1; i >= 0; i--){
+        apply_move(line[i], board);
+    }
+    return length;
+}
+
+/**
+ * Writes the "info" line of a completed iteration: depth, seldepth, score (in centipawns, or moves to mate), nodes, nps, hashfull,
+ * tbhits, time and pv, without the line break.
+ * @param out the line, truncated to size
+ * @param engine the engine that searched
+ * @param best result of the iteration
+ * @param board the root position
+ * @param depth the iteration
+ * @param elapsed ms since the start of the search
+ */
+void format_search_info(char* out, size_t size, const Engine* engine, searchResult* best, uint64_t* board, int depth, long elapsed){
+    char pv[4096];
+    int length = pv_to_string(best, board, pv, sizeof(pv));
+    SearchStats stats = get_search_stats(engine);
+    int score = (board[INFO] & TURN_BIT) ? best->best_eval : -best->best_eval;
+    char score_text[32];
+    if (is_mate_score(score)){
+        snprintf(score_text, sizeof(score_text), "mate %d", score > 0 ? (length + 1) / 2 : -(length / 2));
+    } else {
+        snprintf(score_text, sizeof(score_text), "cp %d", score);
+    }
+    snprintf(out, size, "info depth %d seldepth %d score %s nodes %llu nps %llu hashfull %d tbhits %llu time %ld pv %s", depth, max(stats.seldepth, depth), score_text,
+        (unsigned long long)stats.nodes, (unsigned long long)(stats.nodes * 1000 / (elapsed ? elapsed : 1)), hashfull(&engine->tt), (unsigned long long)stats.tb_hits, elapsed, pv);
+}
+
+/**
+ * Prints the "info" line of a completed iteration, see format_search_info.
+ */
+void print_search_info(const Engine* engine, searchResult* best, uint64_t* board, int depth, long elapsed){
+    char line[UCI_INFO_LENGTH];
+    format_search_info(line, sizeof(line), engine, best, board, depth, elapsed);
+    printf("%s\n", line);
+    fflush(stdout);
+}
+
+// "position startpos|fen <fen> [moves <move>...]", only the moves past the ones already played are applied when the game continues
+static void set_position(char* args){
+    char fen[128];
+    char* moves = strstr(args, " moves");
+    if (moves != NULL){
+        *moves = 0;
+        moves += 6;
+    }
+    if (strncmp(args, "startpos", 8) == 0){
+        snprintf(fen, sizeof(fen), "%s", START_FEN);
+    } else if (strncmp(args, "fen ", 4) == 0){
+        snprintf(fen, sizeof(fen), "%s", args + 4);
+    } else {
+        printf("info string invalid position command\n");
+        return;
+    }
+
+    // count the moves of the command that match the current game
+    char* tokens[UCI_MAX_GAME_PLIES];
+    int num_tokens = 0;
+    for (char* token = moves ? strtok(moves, " ") : NULL; token != NULL; token = strtok(NULL, " ")){
+        if (num_tokens == UCI_MAX_GAME_PLIES){
+            printf("info string position has more than %d moves, ignored\n", UCI_MAX_GAME_PLIES);
+            return;
+        }
+        tokens[num_tokens++] = token;
+    }
+    int common = 0;
+    bool same_game = game.board != NULL && strcmp(fen, game.fen) == 0 && num_tokens >= game.num_moves;
+    while (same_game && common < game.num_moves && strcmp(tokens[common], game.moves[common]) == 0) common++;
+    if (!same_game || common < game.num_moves){
+        free_board(game.board);
+        game.board = from_FEN(fen);
+        snprintf(game.fen, sizeof(game.fen), "%s", fen);
+        game.num_moves = 0;
+        common = 0;
+    }
+
+    for (int i = common; i < num_tokens; i++){
+        Move m;
+        if (!move_from_uci(tokens[i], game.board, &m)){
+            printf("info string illegal move %s\n", tokens[i]);
+            break;
+        }
+        apply_move(&m, game.board);
+        snprintf(game.moves[game.num_moves++], sizeof(game.moves[0]), "%s", tokens[i]);
+    }
+}
+
+// limits of a "go" command, handed to the search thread together with a copy of the position
+typedef struct SearchJob {
+    uint64_t board[BOARD_ARRAY_SIZE];
+    int ply; // of the game, for the book
+    int max_depth;
+    TimeLimits limits;
+    TimeManager tm;
+    bool infinite; // bestmove is held back until "stop"
+    bool ponder; // searching on the opponent's time, bestmove is held back until "ponderhit" or "stop". guarded by job_lock
+    long ponder_hit; // search clock time of a "ponderhit" the worker has not taken over yet, -1 for none. guarded by job_lock
+} SearchJob;
+
+static SearchJob job;
+static pthread_t search_thread;
+static bool searching = false; // a search thread has been started and not joined
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_changed = PTHREAD_COND_INITIALIZER; // signalled on "stop" and "ponderhit"
+
+// between iterations of long searches, called from inside the search about once a second
+static void print_progress(Engine* engine, long elapsed){
+    SearchStats stats = get_search_stats(engine);
+    printf("info depth %d seldepth %d nodes %llu nps %llu hashfull %d tbhits %llu time %ld\n", stats.depth, stats.seldepth, (unsigned long long)stats.nodes,
+        (unsigned long long)(stats.nodes * 1000 / (elapsed ? elapsed : 1)), hashfull(&engine->tt), (unsigned long long)stats.tb_hits, elapsed);
+    fflush(stdout);
+}
+
+// the expected reply is sent as the ponder move, when the principal variation has one
+static void print_bestmove(Move* move, Move* reply, uint64_t* board){
+    if (move == NULL){
+        printf("bestmove 0000\n"); // mate or stalemate at the root
+        fflush(stdout);
+        return;
+    }
+    char name[8];
+    format_uci_move(move, board, name, sizeof(name));
+    printf("bestmove %s", name);
+    if (reply != NULL){
+        apply_move(move, board);
+        format_uci_move(reply, board, name, sizeof(name));
+        printf(" ponder %s", name);
+        apply_move(move, board);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+// waits while a search that finished early may not answer yet
+static void hold_bestmove(SearchJob* j){
+    pthread_mutex_lock(&job_lock);
+    while ((j->infinite || j->ponder) && !engine->stop) pthread_cond_wait(&job_changed, &job_lock);
+    pthread_mutex_unlock(&job_lock);
+}
+
+// takes over a "ponderhit" on the search thread, the time budget then counts from the moment of the hit. returns whether the search
+// is still pondering
+static bool still_pondering(SearchJob* j){
+    pthread_mutex_lock(&job_lock);
+    if (j->ponder_hit >= 0){
+        j->tm.start = j->ponder_hit;
+        j->ponder_hit = -1;
+    }
+    bool ponder = j->ponder;
+    pthread_mutex_unlock(&job_lock);
+    return ponder;
+}
+
+// iterative deepening on the search thread, only completed iterations are reported
+static void* search_worker(void* arg){
+    SearchJob* j = arg;
+    uint64_t* board = j->board;
+    searchResult* best = NULL;
+
+    // known theory is played from the book, analysis searches regardless
+    Move book_move;
+    if (!j->infinite && probe_book(board, j->ply, &book_move)){
+        char name[8];
+        format_uci_move(&book_move, board, name, sizeof(name));
+        printf("info string book move %s\n", name);
+        hold_bestmove(j);
+        print_bestmove(&book_move, NULL, board);
+        return NULL;
+    }
+
+    // a root in the tablebases is answered from the DTZ tables
+    Move tb_move;
+    int wdl;
+    if (tb_probe_root(board, &tb_move, &wdl)){
+        char name[8];
+        format_uci_move(&tb_move, board, name, sizeof(name));
+        printf("info depth 1 seldepth 1 score cp %d nodes 1 tbhits 1 time 0 pv %s\n", wdl == TB_WIN ? TB_WIN_SCORE : wdl == TB_LOSS ? -TB_WIN_SCORE : wdl, name);
+        hold_bestmove(j);
+        print_bestmove(&tb_move, NULL, board);
+        return NULL;
+    }
+
+    // with a single legal move there is nothing to think about, one iteration gives the score
+    Move legal[MOVES_ARRAY_LENGTH];
+    int num_legal = get_legal_moves(legal, board);
+    bool forced = num_legal == 1;
+
+    // a deep enough search of an earlier run is the answer, a shallower one seeds the transposition table
+    int best_depth = 0;
+    bool pondering = still_pondering(j);
+    int depth_wanted = j->infinite || pondering ? INT_MAX : j->max_depth < MAX_SEARCH_DEPTH ? j->max_depth : AnalysisCacheDepth;
+    searchResult* cached = consult_analysis_cache(board, depth_wanted, &engine->tt, &best_depth);
+
+    reset_search_profile();
+    if (cached != NULL){
+        best = cached;
+        print_search_info(engine, best, board, best_depth, 0);
+    }
+    for (int depth = 1; cached == NULL && depth <= j->max_depth; depth++){
+        set_search_depth(engine, depth);
+        searchResult* result = search(engine, board, depth, INT16_MIN, INT16_MAX);
+        if (engine->stop && best != NULL){
+            free_search_result(result); // incomplete iteration
+            break;
+        }
+        free_search_result(best);
+        best = result;
+        best_depth = depth;
+
+        long elapsed = search_elapsed(engine);
+        print_search_info(engine, best, board, depth, elapsed);
+        if (engine->stop || best->best_move.type == BOOK_END) break;
+        pondering = still_pondering(j);
+        if (!pondering && j->tm.limited && (forced || !time_for_next_iteration(&j->tm, best, elapsed))) break;
+    }
+    // a stop before the first iteration searched any root move leaves it without one, a legal move beats "bestmove 0000"
+    if (best->best_move.type == BOOK_END && num_legal > 0){
+        best->best_move = legal[0];
+    }
+
+    if (cached == NULL){
+        record_analysis(board, best, best_depth);
+    }
+    if (dump_search_profile(SEARCH_PROFILE_FILE)){
+        printf("info string search profile written to %s\n", SEARCH_PROFILE_FILE);
+    }
+
+    // infinite and ponder searches only answer once told to stop (or the ponder move is played)
+    hold_bestmove(j);
+    searchResult* reply = best->best_result;
+    print_bestmove(best->best_move.type == BOOK_END ? NULL : &best->best_move, reply != NULL && reply->best_move.type != BOOK_END ? &reply->best_move : NULL, board);
+    free_search_result(best);
+    return NULL;
+}
+
+// stops a running search (which still reports its bestmove) and waits for the thread to finish
+static void stop_search(){
+    if (!searching) return;
+    pthread_mutex_lock(&job_lock);
+    engine->stop = true;
+    pthread_cond_signal(&job_changed);
+    pthread_mutex_unlock(&job_lock);
+    pthread_join(search_thread, NULL);
+    searching = false;
+}
+
+// the opponent played the expected move: the ponder search carries on as a timed search, its clock starting now. the worker moves
+// its time budget between iterations (see still_pondering), the hard limit is handed to the search straight away so that it holds
+// inside the running iteration, the way a stop does
+static void ponder_hit(){
+    if (!searching) return;
+    pthread_mutex_lock(&job_lock);
+    if (job.ponder){
+        job.ponder_hit = search_elapsed(engine);
+        job.ponder = false;
+        set_search_time_limit(engine, job.tm.limited ? job.ponder_hit + job.tm.hard : 0);
+        pthread_cond_signal(&job_changed);
+    }
+    pthread_mutex_unlock(&job_lock);
+}
+
+// "go [ponder] [depth <plies>] [movetime <ms>] [wtime <ms> btime <ms> winc <ms> binc <ms> movestogo <moves>] [infinite]"
+static void go(char* args){
+    stop_search();
+    if (game.board == NULL){
+        char startpos[] = "startpos";
+        set_position(startpos);
+    }
+    memcpy(job.board, game.board, sizeof(job.board));
+    job.ply = ply_from_FEN(game.fen) + game.num_moves;
+    job.max_depth = MAX_SEARCH_DEPTH;
+    job.limits = (TimeLimits){-1, 0, 0, 0};
+    job.infinite = false;
+    job.ponder = false;
+    job.ponder_hit = -1;
+    bool white = game.board[INFO] & TURN_BIT;
+    for (char* token = strtok(args, " "); token != NULL; token = strtok(NULL, " ")){
+        if (strcmp(token, "infinite") == 0){
+            job.infinite = true;
+            continue;
+        } else if (strcmp(token, "ponder") == 0){
+            job.ponder = true;
+            continue;
+        }
+        char* value = strtok(NULL, " ");
+        if (value == NULL) break;
+        if (strcmp(token, "depth") == 0){
+            job.max_depth = min(atoi(value), MAX_SEARCH_DEPTH);
+        } else if (strcmp(token, "movetime") == 0){
+            job.limits.movetime = atol(value);
+        } else if (strcmp(token, white ? "wtime" : "btime") == 0){
+            job.limits.time_left = atol(value);
+        } else if (strcmp(token, white ? "winc" : "binc") == 0){
+            job.limits.increment = atol(value);
+        } else if (strcmp(token, "movestogo") == 0){
+            job.limits.moves_to_go = atoi(value);
+        }
+    }
+    if (!job.infinite && job.max_depth == MAX_SEARCH_DEPTH && job.limits.time_left < 0 && job.limits.movetime == 0){
+        job.limits.movetime = UCI_DEFAULT_MOVETIME;
+    }
+    if (job.infinite){
+        job.limits = (TimeLimits){-1, 0, 0, 0};
+    }
+
+    // the stop flag is cleared and the clock started here, so a "stop" or "ponderhit" that arrives before the thread has started is
+    // not lost, and the time budget is fixed before ponder_hit reads it
+    init_time_manager(&job.tm, &job.limits, 0);
+    start_search_clock(engine, job.ponder ? 0 : job.tm.hard, print_progress);
+    engine->stop = false;
+    searching = pthread_create(&search_thread, NULL, search_worker, &job) == 0;
+    if (!searching){
+        printf("info string could not start search thread\n");
+        search_worker(&job);
+    }
+}
+
+// "setoption name <name> [value <value>]"
+static void set_option(char* args){
+    if (strncmp(args, "name ", 5) != 0) return;
+    char* name = args + 5;
+    char* value = strstr(name, " value ");
+    if (value != NULL){
+        *value = 0;
+        value += 7;
+    }
+    if (strcmp(name, "Clear Hash") == 0){
+        clear_engine(engine);
+    } else if (strcmp(name, "Ponder") == 0){
+        // the engine ponders whenever it is sent "go ponder"
+    } else if (value == NULL){
+        printf("info string missing value for %s\n", name);
+    } else if (strcmp(name, "SyzygyPath") == 0){
+        printf("info string found %d tablebases\n", tb_init(value));
+    } else if (strcmp(name, "SyzygyProbeDepth") == 0){
+        SyzygyProbeDepth = atoi(value);
+    } else if (strcmp(name, "SyzygyProbeLimit") == 0){
+        SyzygyProbeLimit = atoi(value);
+    } else if (strcmp(name, "Hash") == 0){
+        if (engine->tt.shared){
+            printf("info string the shared transposition table keeps its size\n");
+        } else {
+            free_trans_table(&engine->tt);
+            if (!initilize_trans_table(&engine->tt, max(atoi(value), 1))){
+                printf("info string could not allocate %s MB\n", value);
+            }
+        }
+    } else if (strcmp(name, "AnalysisCache") == 0){
+        if (strcmp(value, "<empty>") == 0){
+            close_analysis_cache();
+        } else if (open_analysis_cache(value)){
+            printf("info string analysis cache %s\n", value);
+        }
+    } else if (strcmp(name, "AnalysisCacheDepth") == 0){
+        AnalysisCacheDepth = atoi(value);
+    } else if (strcmp(name, "BookFile") == 0){
+        if (strcmp(value, "<empty>") == 0){
+            close_book();
+        } else if (open_book(value)){
+            printf("info string book %s\n", value);
+        }
+    } else if (strcmp(name, "BookMaxPly") == 0){
+        BookMaxPly = atoi(value);
+    } else if (strcmp(name, "BookSelection") == 0){
+        BookSelection = strcmp(value, "best") == 0 ? BOOK_BEST : BOOK_WEIGHTED;
+    } else if (strcmp(name, "Bitbases") == 0){
+        printf("info string loaded %d bitbases\n", load_bitbases(value));
+    } else {
+        printf("info string unknown option %s\n", name);
+    }
+}
+
+static void identify(){
+    printf("id name Chess_Bot_in_C\n");
+    printf("id author Christopher Elwell\n");
+    printf("option name SyzygyPath type string default <empty>\n");
+    printf("option name SyzygyProbeDepth type spin default %d min 1 max 100\n", TB_DEFAULT_PROBE_DEPTH);
+    printf("option name SyzygyProbeLimit type spin default %d min 0 max %d\n", TB_DEFAULT_PROBE_LIMIT, TB_PIECES);
+    printf("option name Hash type spin default %d min 1 max %d\n", TT_DEFAULT_MB, UCI_MAX_HASH_MB);
+    printf("option name Bitbases type string default %s\n", BITBASE_DEFAULT_FILE);
+    printf("option name AnalysisCache type string default <empty>\n");
+    printf("option name AnalysisCacheDepth type spin default %d min 1 max %d\n", CACHE_DEFAULT_DEPTH, MAX_SEARCH_DEPTH);
+    printf("option name BookFile type string default <empty>\n");
+    printf("option name BookMaxPly type spin default %d min 0 max %d\n", BOOK_DEFAULT_MAX_PLY, UCI_MAX_GAME_PLIES);
+    printf("option name BookSelection type combo default weighted var weighted var best\n");
+    printf("option name Ponder type check default false\n");
+    printf("option name Clear Hash type button\n");
+    printf("uciok\n");
+}
+
+/**
+ * Reads UCI commands from stdin until "quit" or the end of input. Called once "uci" has been received.
+ * @param session_engine searches the games of the session, kept warm between them until "ucinewgame"
+ */
+void uci_loop(Engine* session_engine){
+    static char line[UCI_LINE_LENGTH];
+    engine = session_engine;
+    identify();
+    fflush(stdout);
+
+    while (fgets(line, sizeof(line), stdin) != NULL){
+        line[strcspn(line, "\r\n")] = 0;
+        if (strcmp(line, "uci") == 0){
+            identify();
+        } else if (strcmp(line, "isready") == 0){
+            printf("readyok\n");
+        } else if (strcmp(line, "ucinewgame") == 0){
+            stop_search();
+            clear_engine(engine);
+        } else if (strncmp(line, "position ", 9) == 0){
+            stop_search();
+            set_position(line + 9);
+        } else if (strncmp(line, "go", 2) == 0 && (line[2] == 0 || line[2] == ' ')){
+            go(line + 2);
+        } else if (strncmp(line, "setoption ", 10) == 0){
+            stop_search();
+            set_option(line + 10);
+        } else if (strncmp(line, "savehash ", 9) == 0){
+            stop_search();
+            printf(save_trans_table(&engine->tt, line + 9) ? "info string saved transposition table to %s\n" : "info string could not save %s\n", line + 9);
+        } else if (strncmp(line, "loadhash ", 9) == 0){
+            stop_search();
+            printf(load_trans_table(&engine->tt, line + 9) ? "info string loaded transposition table from %s\n" : "info string could not load %s\n", line + 9);
+        } else if (strcmp(line, "ponderhit") == 0){
+            ponder_hit();
+        } else if (strcmp(line, "stop") == 0){
+            stop_search(); // also ends a ponder search on a miss, what it stored in the transposition table is kept
+        } else if (strcmp(line, "quit") == 0){
+            break;
+        } else if (line[0] != 0){
+            printf("info string unknown command %s\n", line);
+        }
+        fflush(stdout);
+    }
+    stop_search();
+    free_board(game.board);
+    game.board = NULL;
+    engine = NULL;
+}
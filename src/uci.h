@@ -0,0 +1,13 @@
+#pragma once
+#include "search.h"
+#include <stddef.h>
+
+#define UCI_DEFAULT_MOVETIME 500 // ms per move when go gives no limits
+#define UCI_MAX_GAME_PLIES 1024
+#define UCI_LINE_LENGTH 8192 // position commands of long games carry every move
+#define UCI_MAX_HASH_MB 65536
+#define UCI_INFO_LENGTH 4352 // an info line with the longest principal variation
+
+void uci_loop(Engine* session_engine);
+void format_search_info(char* out, size_t size, const Engine* engine, searchResult* best, uint64_t* board, int depth, long elapsed);
+void print_search_info(const Engine* engine, searchResult* best, uint64_t* board, int depth, long elapsed);